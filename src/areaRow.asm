@@ -0,0 +1,214 @@
+assume adl=1
+section .text
+public _accumulateRGBRow
+; Arguments (C Convention):
+; uint8_t* rowBuffer
+; unsigned int count
+; AreaState* state
+_accumulateRGBRow:
+    ; Init IX
+    push ix
+    ld ix, 0
+    add ix, sp
+
+    ; Check that count > 0
+    ld bc, (ix + count)
+    sbc hl, hl
+    adc hl, bc
+
+    ; If count is 0, return
+    jr z, rgb_the_end
+
+    ; Set IY to rowBuffer
+    ld iy, (ix + rowBuffer)
+
+    ; Push state to the stack and load it
+    ld hl, (ix + state)
+    push hl
+    call load_state
+
+    ; Register allocation
+    ; IX: accumulator
+    ; IY: rowBuffer
+    ; DE: channel value (D and the upper byte are always 0)
+    ; HL: running total
+    ; BC: pixels left
+    ld de, 0
+rgb_pixel_loop:
+    ; Add the blue channel to the running total
+    ld e, (iy)
+    ld hl, (ix + blue)
+    add hl, de
+    ld (ix + blue), hl
+    ; Add the green channel to the running total
+    ld e, (iy + 1)
+    ld hl, (ix + green)
+    add hl, de
+    ld (ix + green), hl
+    ; Add the red channel to the running total
+    ld e, (iy + 2)
+    ld hl, (ix + red)
+    add hl, de
+    ld (ix + red), hl
+    ; Move to the next pixel
+    lea iy, iy + 3
+    ; Count down the pixels left for this screen pixel
+    ld hl, columnRemaining
+    dec (hl)
+    call z, next_column
+    ; Count down the pixels left in the row
+    dec bc
+    sbc hl, hl
+    adc hl, bc
+    ; If it's not 0, jump to the beginning
+    jr nz, rgb_pixel_loop
+
+    ; Save where we got up to back to state
+    pop hl
+    call store_state
+rgb_the_end:
+    pop ix
+    ret
+
+public _accumulate565Row
+; Arguments (C Convention):
+; uint16_t* pixels
+; unsigned int count
+; AreaState* state
+_accumulate565Row:
+    ; Init IX
+    push ix
+    ld ix, 0
+    add ix, sp
+
+    ; Check that count > 0
+    ld bc, (ix + count)
+    sbc hl, hl
+    adc hl, bc
+
+    ; If count is 0, return
+    jr z, native_the_end
+
+    ; Set IY to pixels
+    ld iy, (ix + rowBuffer)
+
+    ; Push state to the stack and load it
+    ld hl, (ix + state)
+    push hl
+    call load_state
+
+    ; Register allocation
+    ; IX: accumulator
+    ; IY: pixels
+    ; DE: field value (D and the upper byte are always 0)
+    ; HL: running total
+    ; BC: pixels left
+    ld de, 0
+native_pixel_loop:
+    ; Blue is the bottom 5 bits of the low byte
+    ld a, (iy)
+    and a, 01Fh
+    ld e, a
+    ld hl, (ix + blue)
+    add hl, de
+    ld (ix + blue), hl
+    ; Green is bits 5-10, shift them up into H
+    ld hl, (iy)
+    add hl, hl
+    add hl, hl
+    add hl, hl
+    ld a, h
+    and a, 03Fh
+    ld e, a
+    ld hl, (ix + green)
+    add hl, de
+    ld (ix + green), hl
+    ; Red is the top 5 bits of the high byte
+    ld a, (iy + 1)
+    rrca
+    rrca
+    rrca
+    and a, 01Fh
+    ld e, a
+    ld hl, (ix + red)
+    add hl, de
+    ld (ix + red), hl
+    ; Move to the next pixel
+    lea iy, iy + 2
+    ; Count down the pixels left for this screen pixel
+    ld hl, columnRemaining
+    dec (hl)
+    call z, next_column
+    ; Count down the pixels left in the row
+    dec bc
+    sbc hl, hl
+    adc hl, bc
+    ; If it's not 0, jump to the beginning
+    jr nz, native_pixel_loop
+
+    ; Save where we got up to back to state
+    pop hl
+    call store_state
+native_the_end:
+    pop ix
+    ret
+
+; Moves on to the accumulator for the next screen pixel
+; Destroys A and HL
+next_column:
+    lea ix, ix + 9
+    ld hl, (columnCounts)
+    inc hl
+    ld (columnCounts), hl
+    ld a, (hl)
+    ld (columnRemaining), a
+    ret
+
+; Loads the AreaState pointed to by HL
+; IX gets the accumulator, and the rest goes into columnCounts and columnRemaining
+; Destroys A, DE and HL
+load_state:
+    ld ix, (hl)
+    inc hl
+    inc hl
+    inc hl
+    ld de, (hl)
+    ld (columnCounts), de
+    inc hl
+    inc hl
+    inc hl
+    ld a, (hl)
+    ld (columnRemaining), a
+    ret
+
+; Writes IX, columnCounts and columnRemaining back to the AreaState pointed to by HL
+; Destroys A, DE and HL
+store_state:
+    ld (hl), ix
+    inc hl
+    inc hl
+    inc hl
+    ld de, (columnCounts)
+    ld (hl), de
+    inc hl
+    inc hl
+    inc hl
+    ld a, (columnRemaining)
+    ld (hl), a
+    ret
+
+section .data
+; Pointer to the count for the current screen pixel
+columnCounts:
+    dl 0
+; Source pixels left to add to the current screen pixel
+columnRemaining:
+    db 0
+
+rowBuffer equ 6
+count equ 9
+state equ 12
+; Offsets into AreaAccumulator
+blue equ 0
+green equ 3
+red equ 6
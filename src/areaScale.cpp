@@ -0,0 +1,74 @@
+#include <cstdint>
+#include "areaScale.hpp"
+#include "common.h"
+
+// Works out how many source pixels get averaged into each screen pixel along a row.
+// counts needs room for renderWidth + 1 entries, as the kernels step onto the one past the end after the last pixel.
+// Returns false if the image can't be area averaged (it isn't being shrunk, or it's being shrunk by more than 255 times).
+bool areaCountColumns(unsigned int width, unsigned int renderWidth, uint8_t* counts) {
+    uint32_t start = 0;
+    for (unsigned int i = 0; i < renderWidth; i++) {
+        uint32_t end = (static_cast<uint32_t>(i + 1)*width)/renderWidth;
+        if (end == start || end - start > 255) {
+            return false;
+        }
+        counts[i] = end - start;
+        start = end;
+    }
+    counts[renderWidth] = 1;
+    return true;
+}
+
+// Finds the first source row that gets averaged into the given screen row
+unsigned int areaRowStart(unsigned int row, unsigned int height, unsigned int renderHeight) {
+    return (static_cast<uint32_t>(row)*height)/renderHeight;
+}
+
+// Finds the screen row that the given source row gets averaged into
+unsigned int areaScreenRow(unsigned int row, unsigned int height, unsigned int renderHeight) {
+    return (static_cast<uint32_t>(row + 1)*renderHeight - 1)/height;
+}
+
+// Points the accumulate kernels at the start of a row
+void areaStartRow(AreaState* state, AreaAccumulator* accumulator, const uint8_t* counts) {
+    state->accumulator = accumulator;
+    state->counts = counts;
+    state->remaining = *counts;
+}
+
+// Turns the totals for a finished row of screen pixels into averages, draws them, and zeroes the accumulators for the next row.
+// rows is how many source rows were added into this one.
+// If native is set, the totals are of 5-6-5 fields (from accumulate565Row) rather than 8 bit channels.
+void areaResolveRow(AreaAccumulator* accumulator, const uint8_t* counts, unsigned int columns, unsigned int rows, bool native, uint16_t* screenPointer) {
+    ColorError err = {};
+    unsigned int lastPixels = 0;
+    unsigned int redBlueReciprocal = 0;
+    unsigned int greenReciprocal = 0;
+    for (unsigned int i = 0; i < columns; i++) {
+        uint8_t color[3];
+        unsigned int pixels = counts[i]*rows;
+        // Dividing is slow, so multiply by a 16.16 fixed point reciprocal instead.
+        // Only a couple of different counts ever show up in a row, so it rarely needs working out again.
+        // For 5-6-5 totals, the reciprocal also scales the fields back up to 0-255.
+        // (The totals are at most 255 times the number of pixels, so none of these can overflow 24 bits.)
+        if (pixels != lastPixels) {
+            lastPixels = pixels;
+            if (native) {
+                redBlueReciprocal = 539086/pixels;
+                greenReciprocal = 265264/pixels;
+            } else {
+                redBlueReciprocal = 65536/pixels;
+                greenReciprocal = redBlueReciprocal;
+            }
+        }
+        color[0] = (accumulator->blue*redBlueReciprocal + 32768) >> 16;
+        color[1] = (accumulator->green*greenReciprocal + 32768) >> 16;
+        color[2] = (accumulator->red*redBlueReciprocal + 32768) >> 16;
+        *screenPointer = rgb888to565(color, &err);
+        screenPointer++;
+        accumulator->blue = 0;
+        accumulator->green = 0;
+        accumulator->red = 0;
+        accumulator++;
+    }
+}
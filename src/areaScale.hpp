@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+
+// How many pixels of formats that have to be converted to 565 before they can be added up get converted at once
+#define areaStripWidth 320
+
+// Running totals for one screen pixel while area averaging
+struct AreaAccumulator {
+    uint24_t blue;
+    uint24_t green;
+    uint24_t red;
+};
+
+// Where the accumulate kernels are up to in a row
+struct AreaState {
+    // The accumulator for the screen pixel currently being added to
+    AreaAccumulator* accumulator;
+    // The number of source pixels that go into that screen pixel (points into the array filled in by areaCountColumns)
+    const uint8_t* counts;
+    // How many source pixels are still to be added to it
+    uint8_t remaining;
+};
+
+extern "C" {
+    // Adds a run of rgb888 pixels to the accumulators
+    void accumulateRGBRow(const uint8_t* rowBuffer, unsigned int count, AreaState* state);
+    // Adds a run of 565 pixels to the accumulators
+    void accumulate565Row(const uint16_t* pixels, unsigned int count, AreaState* state);
+}
+
+bool areaCountColumns(unsigned int width, unsigned int renderWidth, uint8_t* counts);
+unsigned int areaRowStart(unsigned int row, unsigned int height, unsigned int renderHeight);
+unsigned int areaScreenRow(unsigned int row, unsigned int height, unsigned int renderHeight);
+void areaStartRow(AreaState* state, AreaAccumulator* accumulator, const uint8_t* counts);
+void areaResolveRow(AreaAccumulator* accumulator, const uint8_t* counts, unsigned int columns, unsigned int rows, bool native, uint16_t* screenPointer);
@@ -0,0 +1,101 @@
+#include <cstdlib>
+#include <cstdint>
+#include <fileioc.h>
+#include "arena.hpp"
+
+arena imageArena = {nullptr, 0, 0, 0};
+arena directoryArena = {nullptr, 0, 0, 0};
+
+// Grabs the memory for an arena from the heap, halving the size until it fits (down to a quarter of what was asked for)
+bool arenaInit(arena* memory, size_t size) {
+    size_t minSize = size/4;
+    memory->base = nullptr;
+    while (!memory->base && size && size >= minSize) {
+        memory->base = static_cast<uint8_t*>(malloc(size));
+        if (!memory->base) {
+            size /= 2;
+        }
+    }
+    memory->size = memory->base ? size : 0;
+    memory->used = 0;
+    memory->highWater = 0;
+    return memory->base != nullptr;
+}
+
+void arenaFree(arena* memory) {
+    free(memory->base);
+    memory->base = nullptr;
+    memory->size = 0;
+    memory->used = 0;
+}
+
+// Grabs the memory for an arena from a new appvar, halving the size until it fits (down to a quarter of what was asked for)
+bool arenaInitAppVar(arena* memory, const char* name, size_t size) {
+    size_t minSize = size/4;
+    memory->base = nullptr;
+    uint8_t handle = ti_Open(name, "w");
+    if (handle) {
+        while (!memory->base && size && size >= minSize) {
+            if (ti_Resize(size, handle) == static_cast<int>(size)) {
+                memory->base = static_cast<uint8_t*>(ti_GetDataPtr(handle));
+            } else {
+                size /= 2;
+            }
+        }
+        ti_Close(handle);
+    }
+    memory->size = memory->base ? size : 0;
+    memory->used = 0;
+    memory->highWater = 0;
+    return memory->base != nullptr;
+}
+
+void arenaFreeAppVar(arena* memory, const char* name) {
+    ti_Delete(name);
+    memory->base = nullptr;
+    memory->size = 0;
+    memory->used = 0;
+}
+
+// Finds the biggest block that fits by trying to allocate it (to within 256 bytes)
+size_t heapLargestBlock() {
+    size_t low = 0;
+    size_t high = 64*1024;
+    while (high - low > 256) {
+        size_t middle = (low + high)/2;
+        void* block = malloc(middle);
+        if (block) {
+            free(block);
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+void* arenaAlloc(arena* memory, size_t bytes) {
+    if (bytes > memory->size - memory->used) {
+        return nullptr;
+    }
+    void* pointer = memory->base + memory->used;
+    memory->used += bytes;
+    if (memory->used > memory->highWater) {
+        memory->highWater = memory->used;
+    }
+    return pointer;
+}
+
+size_t arenaMark(arena* memory) {
+    return memory->used;
+}
+
+void arenaRelease(arena* memory, size_t mark) {
+    if (mark < memory->used) {
+        memory->used = mark;
+    }
+}
+
+void arenaReset(arena* memory) {
+    memory->used = 0;
+}
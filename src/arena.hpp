@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// A block of memory that gets handed out front to back, and taken back all at once (or back to a mark).
+// Everything that only lives as long as one image (or one directory listing) comes out of an arena,
+// so viewing image after image can't break the heap up into pieces too small for the next one.
+struct arena {
+    uint8_t* base;
+    size_t size;
+    size_t used;
+    // The most that's ever been in use at once
+    size_t highWater;
+};
+
+// How the heap gets shared out.
+// The toolchain links .bss and the heap into the ~59KB from 0xD052C6 to 0xD13FD8 (see buffer.cpp), so the image arena and
+// the input buffer at their biggest don't fit at once. What's actually free gets measured when the viewer starts,
+// and handed out in this order:
+// - heapReserve is left alone, for the few small blocks that still come straight off the heap
+//   (the frame cache and thumbnail buffers)
+// - the input buffer gets the size the settings ask for, as long as that leaves imageArenaMinSize for the image arena
+// - the image arena gets whatever's left, up to imageArenaSize
+#define heapReserve (4*1024)
+#define imageArenaSize (56*1024)
+#define imageArenaMinSize (8*1024)
+
+// The directory arena needs room for a 5000 file directory (12 bytes an entry) and the listings above it, which is more than
+// the whole heap. It lives in a temporary appvar in user RAM instead, which gets deleted again when the viewer exits.
+// Nothing creates, resizes or deletes any other variables while the viewer is running, so the appvar never moves.
+// An appvar can't be much bigger than 64KB.
+#define directoryArenaVar "BMP84LST"
+#define directoryArenaSize 65000
+
+extern arena imageArena;
+extern arena directoryArena;
+
+bool arenaInit(arena* memory, size_t size);
+void arenaFree(arena* memory);
+// Same as arenaInit and arenaFree, for an arena that lives in an appvar called name
+bool arenaInitAppVar(arena* memory, const char* name, size_t size);
+void arenaFreeAppVar(arena* memory, const char* name);
+// How big a block malloc can hand out right now
+size_t heapLargestBlock();
+// Returns nullptr if the arena is full
+void* arenaAlloc(arena* memory, size_t bytes);
+// Everything allocated after a mark can be freed by releasing back to it
+size_t arenaMark(arena* memory);
+void arenaRelease(arena* memory, size_t mark);
+void arenaReset(arena* memory);
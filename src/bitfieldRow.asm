@@ -0,0 +1,262 @@
+assume adl=1
+section .text
+public _displayBitFieldRow
+; Arguments (C Convention):
+; uint8_t* pixels
+; unsigned int count (must be less than 65536)
+; unsigned int width
+; unsigned int renderWidth
+; size_t bytesPerPixel
+; BitfieldTables* tables
+; uint16_t* screenPointer
+; RowState* state
+; Returns:
+; hl: screenPointer after the last pixel written
+_displayBitFieldRow:
+    ; Local variables:
+    ; int xError
+    ; unsigned int x
+    ; uint8_t color[3]
+    ; BitfieldChannel* blueChannel
+    ; BitfieldChannel* greenChannel
+    ; BitfieldChannel* redChannel
+    ; BitfieldChannel* alphaChannel
+    ; uint8_t* pixel
+    ; Init IX
+    push ix
+    ld ix, 0
+    add ix, sp
+
+    ; Make room on the stack for local variables
+    ld hl, -24
+    add hl, sp
+    ld sp, hl
+
+    ; Load xError from state
+    ld hl, (ix + state)
+    ld de, (hl)
+    ld (ix + xError), de
+
+    ; Push &state->err to the stack for rgb888to565
+    inc hl
+    inc hl
+    inc hl
+    push hl
+
+    ; Check that count > 0
+    ld de, (ix + count)
+    sbc hl, hl
+    adc hl, de
+
+    ; If count is 0, return
+    jp z, return
+
+    ; Work out where the tables for each channel are
+    ld hl, (ix + tables)
+    ld bc, channelSize
+    ld (ix + blueChannel), hl
+    add hl, bc
+    ld (ix + greenChannel), hl
+    add hl, bc
+    ld (ix + redChannel), hl
+    add hl, bc
+    ld (ix + alphaChannel), hl
+
+    ; Init the registers
+    ld iy, (ix + pixels)
+    ld hl, (ix + xError)
+
+    ; If the first pixel doesn't get drawn (the last run of pixels ended partway through skipping), go straight to skipping
+    bit 7, (ix + xError + 2)
+    jp nz, skip_pixel
+
+fill_pixels:
+    ; Write x and pixel back to local variables
+    ld (ix + varX), de
+    ld (ix + varPixel), iy
+    ; Look up each channel of the pixel
+    ld hl, (ix + blueChannel)
+    call channel_value
+    ld (ix + varColor), a
+    ld hl, (ix + greenChannel)
+    call channel_value
+    ld (ix + varColor + 1), a
+    ld hl, (ix + redChannel)
+    call channel_value
+    ld (ix + varColor + 2), a
+    ld hl, (ix + alphaChannel)
+    call channel_value
+
+    ; If alpha is 255, the pixel is opaque and can be used as is
+    inc a
+    jr z, alpha_cont
+    dec a
+
+    ; Premultiply each channel by alpha
+    ; Use a + (a >> 7) instead of a, so that (channel*alpha) >> 8 comes out close to (channel*a)/255 without a division
+    ld c, a
+    rlca
+    ld a, c
+    adc a, 0
+    ld c, a
+
+    ld h, (ix + varColor)
+    ld l, c
+    mlt hl
+    ld (ix + varColor), h
+
+    ld h, (ix + varColor + 1)
+    ld l, c
+    mlt hl
+    ld (ix + varColor + 1), h
+
+    ld h, (ix + varColor + 2)
+    ld l, c
+    mlt hl
+    ld (ix + varColor + 2), h
+
+alpha_cont:
+    ; Get the pixel value
+    pea ix + varColor
+    call _rgb888to565
+    pop de
+
+    ; Register allocation
+    ; HL: xError
+    ; DE: pixel
+    ; BC: width
+    ; IY: screenPointer
+    ; Init the registers
+    ex de, hl
+    ld hl, (ix + xError)
+    ld bc, (ix + width)
+    ld iy, (ix + screenPointer)
+    ; Clear the carry flag
+    or a, a
+fill_pixel_loop:
+    ; Write pixels while xError >= 0
+    ld (iy), e
+    ld (iy + 1), d
+    ; Increment screenPointer
+    lea iy, iy + 2
+    ; Update xError
+    sbc hl, bc
+    ; If no carry (xError did not wrap around from being positive to negative),
+    ; jump to the beginning of the loop
+    jr nc, fill_pixel_loop
+    ; Update screenPointer
+    ld (ix + screenPointer), iy
+    ; Register allocation
+    ; HL: xError
+    ; DE: x
+    ; BC: renderWidth
+    ; IY: pixel
+    ; Init the registers
+    ld de, (ix + varX)
+    ld iy, (ix + varPixel)
+skip_pixel:
+    ld bc, (ix + renderWidth)
+skip_pixel_loop:
+    ; While xError < 0, update x, pixel and xError
+    push de
+    ld de, (ix + bytesPerPixel)
+    add iy, de
+    pop de
+    dec de
+    ; Add renderWidth to xError
+    add hl, bc
+    ; If carry (xError wrapped around from being negative to positive), draw the next pixel
+    jr c, next_pixel
+    ; Otherwise, keep skipping pixels, as long as there are any left
+    ld a, d
+    or a, e
+    jr nz, skip_pixel_loop
+    jr the_end
+next_pixel:
+    ; Update xError
+    ld (ix + xError), hl
+    ; Check if x is 0
+    ld a, d
+    or a, e
+    ; If it's not 0, jump to the beginning
+    jp nz, fill_pixels
+the_end:
+    ; Save xError for the next run of pixels
+    ld iy, (ix + state)
+    ld (iy), hl
+return:
+    ; Return screenPointer
+    ld hl, (ix + screenPointer)
+    ld sp, ix
+    pop ix
+    ret
+
+; Works out the value of one channel of a pixel
+; The channel value is the sum of the low table entry for the first byte of the channel's window
+; and the high table entry for the byte after it, in 8.8 fixed point
+; Input: HL = BitfieldChannel*, IY = pixel
+; Output: A = channel value (0-255)
+; Destroys BC, DE and HL
+channel_value:
+    ; Load the offset of the window into the pixel
+    ld de, (hl)
+    inc hl
+    inc hl
+    inc hl
+    ; DE: low table
+    ; HL: pointer to the window
+    ex de, hl
+    lea bc, iy + 0
+    add hl, bc
+    ; C: first byte of the window
+    ; A: second byte of the window
+    ld bc, 0
+    ld c, (hl)
+    inc hl
+    ld a, (hl)
+    ; Look up the first byte in the low table
+    ex de, hl
+    push hl
+    add hl, bc
+    add hl, bc
+    ld e, (hl)
+    inc hl
+    ld d, (hl)
+    ; Look up the second byte in the high table
+    pop hl
+    ld bc, 512
+    add hl, bc
+    ld bc, 0
+    ld c, a
+    add hl, bc
+    add hl, bc
+    ld a, (hl)
+    inc hl
+    ld h, (hl)
+    ld l, a
+    ; Add the two together and take the integer part
+    add hl, de
+    ld a, h
+    ret
+
+pixels equ 6
+count equ 9
+width equ 12
+renderWidth equ 15
+bytesPerPixel equ 18
+tables equ 21
+screenPointer equ 24
+state equ 27
+xError equ -3
+varX equ -6
+varColor equ -9
+blueChannel equ -12
+greenChannel equ -15
+redChannel equ -18
+alphaChannel equ -21
+varPixel equ -24
+
+; sizeof(BitfieldChannel)
+channelSize equ 3 + 512 + 512
+
+extern _rgb888to565
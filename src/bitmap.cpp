@@ -8,134 +8,702 @@
 #include "bitmap.hpp"
 #include "common.h"
 #include "usb.h"
+#include "areaScale.hpp"
+#include "screen.hpp"
+#include "thumbnail.hpp"
+#include "cache.hpp"
+#include "arena.hpp"
+#include "dither.hpp"
 
 extern "C" {
     int32_t abs_long(int32_t x);
-    // Draws a row of rgb888 pixels
+    // All of the row kernels draw a run of count pixels from a row that's width pixels wide (scaled to renderWidth),
+    // picking up where the last run left off (as recorded in state), and return where they got up to in vram.
+    // This lets rows be drawn straight out of the input buffer, one piece at a time.
+    // Draws rgb888 pixels
     // Only used in cases where each pixel is 3 bytes
-    void displayRGBRow(uint8_t* rowBuffer, unsigned int width, unsigned int renderWidth, uint16_t* screenPointer);
-    // Draws a row of rgba8888 pixels
+    uint16_t* displayRGBRow(uint8_t* pixels, unsigned int count, unsigned int width, unsigned int renderWidth, uint16_t* screenPointer, RowState* state);
+    // Draws rgba8888 pixels
     // Only used in cases where each pixel is 4 bytes
-    void displayRGBARow(uint8_t* rowBuffer, unsigned int width, unsigned int renderWidth, uint16_t* screenPointer);
-    // Draws a row of indexed 8bpp color pixels using the provided palette
-    void displayIndexed8Row(uint8_t* rowBuffer, int width, unsigned int renderWidth, uint16_t* palette, uint16_t* screenPointer);
-    // Draws a row of native pixels
-    void displayNativeRow(uint8_t* rowBuffer, int width, unsigned int renderWidth, uint16_t* screenPointer);
+    uint16_t* displayRGBARow(uint8_t* pixels, unsigned int count, unsigned int width, unsigned int renderWidth, uint16_t* screenPointer, RowState* state);
+    // Draws indexed 8bpp color pixels using the provided palette
+    uint16_t* displayIndexed8Row(uint8_t* pixels, unsigned int count, unsigned int width, unsigned int renderWidth, uint16_t* palette, uint16_t* screenPointer, RowState* state);
+    // Draws indexed color pixels in cases where the bit depth is less than 8, using the table from generatePackedTable
+    uint16_t* displayPackedRow(uint8_t* pixels, unsigned int count, unsigned int width, unsigned int renderWidth, uint16_t* table, uint8_t pixelsPerByte, uint16_t* screenPointer, RowState* state);
+    // Copies 8bpp indices to vram as they are (for when the LCD is in 8bpp mode)
+    uint8_t* displayIndexRow(uint8_t* pixels, unsigned int count, unsigned int width, unsigned int renderWidth, uint8_t* screenPointer, RowState* state);
+    // Draws native pixels
+    uint16_t* displayNativeRow(uint8_t* pixels, unsigned int count, unsigned int width, unsigned int renderWidth, uint16_t* screenPointer, RowState* state);
+    // Draws pixels using the bitmasks in the BITMAPV4HEADER (through the tables built by generateBitfieldChannel)
+    uint16_t* displayBitFieldRow(uint8_t* pixels, unsigned int count, unsigned int width, unsigned int renderWidth, size_t bytesPerPixel, BitfieldTables* tables, uint16_t* screenPointer, RowState* state);
 }
 
+// The most pixels handed to a row kernel at once (the kernels count pixels in 16 bits).
+// Kept a multiple of 8 so that runs of 1, 2 and 4bpp pixels always end on a byte boundary.
+#define maxRunLength 0x8000
+
+// How many rows of a run length encoded image there are between each of the checkpoints it can be rewound to
+#define rleCheckpointRows 16
+
+// How far the arrow keys move the view around a zoomed in image, in pixels.
+// Kept a multiple of 8 so that the view always starts on a byte boundary in 1, 2 and 4bpp images.
+#define panStep 32
+
 /*
 Left to do:
 Check for invalid values in the bitmap header
 */
 
-// Finds the shift required to take a bitmasked value and converted to a standard range (specifically 0-255)
-// For example, for a bitmask of 0xFF00, to limit the range of the masked result to 0-255, you need to shift it right by 8
-int8_t findBitMaskShift(uint32_t bitmask) {
-    int8_t shifts = -5;
-    if (!bitmask) {
-        return shifts;
+// Takes a bitmap color table and converts it to a BGR 565 palette
+void generatePalette(unsigned int colors, uint8_t* colorTable, uint16_t* palette) {
+    for (unsigned int i = 0; i < colors; i++) {
+        ColorError err = {};
+        palette[i] = rgb888to565(colorTable, &err);
+        colorTable += 4;
+    }
+}
+
+// Builds the table displayPackedRow uses to turn a whole byte of a 1, 2 or 4bpp image into pixels at once.
+// Each entry holds the colors of every pixel in that byte, from left to right.
+// Indices past the end of the palette come out black.
+void generatePackedTable(uint8_t bitsPerPixel, unsigned int colors, uint16_t* palette, uint16_t* table) {
+    uint8_t pixelsPerByte = 8/bitsPerPixel;
+    uint8_t bitMask = (1 << bitsPerPixel) - 1;
+    for (unsigned int byte = 0; byte < 256; byte++) {
+        for (uint8_t pixel = 0; pixel < pixelsPerByte; pixel++) {
+            uint8_t index = (byte >> (8 - (bitsPerPixel*(pixel + 1)))) & bitMask;
+            *table = (index < colors) ? palette[index] : 0;
+            table++;
+        }
+    }
+}
+
+// Fills in the lookup tables for one channel of a BI_BITFIELDS image.
+// If the channel isn't there (the mask is 0), it comes out as missing.
+void generateBitfieldChannel(uint32_t mask, size_t bytesPerPixel, uint8_t missing, BitfieldChannel* channel) {
+    uint8_t lowBit = 0;
+    uint8_t highBit;
+    uint8_t bits;
+    uint16_t fieldMask;
+    uint8_t shift;
+    memset(channel->high, 0, sizeof(channel->high));
+    if (!mask) {
+        channel->offset = 0;
+        for (unsigned int i = 0; i < 256; i++) {
+            channel->low[i] = missing << 8;
+        }
+        return;
+    }
+    // Find where the channel is in the pixel
+    while (!((mask >> lowBit) & 1)) {
+        lowBit++;
+    }
+    highBit = lowBit;
+    while (highBit < 31 && ((mask >> (highBit + 1)) & 1)) {
+        highBit++;
+    }
+    // Anything past the top 8 bits of the channel won't make it to the screen anyway
+    bits = highBit - lowBit + 1;
+    if (bits > 8) {
+        lowBit = highBit - 7;
+        bits = 8;
+    }
+    // Pick the window so it doesn't run off the end of the pixel
+    channel->offset = lowBit/8;
+    if (channel->offset > bytesPerPixel - 2) {
+        channel->offset = bytesPerPixel - 2;
+    }
+    shift = lowBit - (channel->offset*8);
+    fieldMask = (1 << bits) - 1;
+    // Scale each byte's share of the channel up to 0-255 (times 256). Adding 128 to the low table rounds the sum.
+    for (unsigned int i = 0; i < 256; i++) {
+        channel->low[i] = (((i >> shift) & fieldMask)*65280UL)/fieldMask + 128;
+        channel->high[i] = ((((i << 8) >> shift) & fieldMask)*65280UL)/fieldMask;
+    }
+}
+
+// Keeps track of which part of the file is currently held in the input buffer.
+// The input buffer is used as two halves: the one being read from, and the one the next chunk of the file is coming into in the background.
+struct bitmapReader {
+    // File handle
+    fat_file_t* handle;
+    // Offset (in blocks) into the file of the first block in the current half
+    size_t bufferBlock;
+    // The half of the input buffer that's being read from, and the end of it
+    uint8_t* buffer;
+    uint8_t* bufferEnd;
+    // Pointer to our current location in the buffer
+    uint8_t* inputPointer;
+    // Whether the chunk after the current one has been started coming into the other half
+    bool prefetched;
+    // Whether the current half holds the chunk starting at bufferBlock
+    // (it doesn't once the file's been read from without going through the reader)
+    bool filled;
+};
+
+// The half of the input buffer that isn't being read from
+uint8_t* bitmapOtherHalf(bitmapReader* reader) {
+    return reader->buffer == inputBuffer ? inputBuffer + inputHalfSize : inputBuffer;
+}
+
+// Starts loading the chunk after the current one into the other half of the input buffer
+void bitmapPrefetch(bitmapReader* reader) {
+    reader->prefetched = readFileAsync(reader->handle, inputHalfBlocks, bitmapOtherHalf(reader));
+}
+
+// Switches over to the chunk of the file following the one currently in the input buffer,
+// and starts loading the one after that
+bool bitmapRefill(bitmapReader* reader) {
+    if (!waitForReads() || !reader->prefetched) {
+        return false;
+    }
+    reader->bufferBlock += inputHalfBlocks;
+    reader->buffer = bitmapOtherHalf(reader);
+    reader->bufferEnd = reader->buffer + inputHalfSize;
+    reader->inputPointer = reader->buffer;
+    bitmapPrefetch(reader);
+    return true;
+}
+
+// Moves the reader to an absolute byte offset into the file
+// Only goes out to the drive if the offset isn't in the chunk that's already in the input buffer (or on its way in)
+bool bitmapSeek(bitmapReader* reader, uint32_t offset) {
+    size_t block = offset/FAT_BLOCK_SIZE;
+    if (reader->filled && reader->prefetched && block >= reader->bufferBlock + inputHalfBlocks && block < reader->bufferBlock + 2*inputHalfBlocks) {
+        // It's in the chunk that's being loaded in the background
+        if (!bitmapRefill(reader)) {
+            return false;
+        }
+    } else if (!reader->filled || block < reader->bufferBlock || block >= reader->bufferBlock + inputHalfBlocks) {
+        // Whatever's coming in is going to be thrown out
+        waitForReads();
+        if (!seekFile(reader->handle, block, set)) {
+            return false;
+        }
+        if (!readFile(reader->handle, inputHalfBlocks, reader->buffer)) {
+            return false;
+        }
+        reader->bufferBlock = block;
+        reader->filled = true;
+        bitmapPrefetch(reader);
     }
-    while (bitmask) {
-        bitmask >>= 1;
-        shifts++;
+    reader->inputPointer = reader->buffer + (offset - static_cast<uint32_t>(reader->bufferBlock)*FAT_BLOCK_SIZE);
+    return true;
+}
+
+// State for decoding a BI_RLE8 or BI_RLE4 image one row at a time
+struct rleDecoder {
+    // Where the compressed data is coming from
+    bitmapReader* reader;
+    // True for BI_RLE4, false for BI_RLE8
+    bool fourBit;
+    // Set once the end of bitmap escape has been hit
+    bool endOfBitmap;
+    // How many rows have been decoded so far
+    unsigned int row;
+    // How many completely blank rows are left over from a delta escape
+    unsigned int blankRows;
+    // The column to start the next row at (set by delta escapes)
+    unsigned int startX;
+};
+
+// Everything needed to pick up decoding a run length encoded image from the start of a row
+struct rleCheckpoint {
+    // Offset into the file of the next byte of compressed data
+    uint32_t offset;
+    unsigned int blankRows;
+    unsigned int startX;
+    bool endOfBitmap;
+};
+
+// Grabs the next byte of the compressed data, loading the next chunk of the file if we've run off the end of the input buffer
+bool rleReadByte(bitmapReader* reader, uint8_t* byte) {
+    if (reader->inputPointer >= reader->bufferEnd) {
+        if (!bitmapRefill(reader)) {
+            return false;
+        }
     }
-    return shifts;
+    *byte = *reader->inputPointer;
+    reader->inputPointer++;
+    return true;
 }
 
-// Draws a row of indexed color pixels in cases where the bit depth is less than 8
-void displayIndexedRow(uint8_t* rowBuffer, int width, unsigned int renderWidth, uint8_t bitsPerPixel, uint16_t* palette, uint16_t* screenPointer) {
-    uint8_t bitMask = (1 << bitsPerPixel)-1;
-    uint8_t pixelShift = 8 - bitsPerPixel;
-    int xError = 0;
-    unsigned int x = 0;
-    while (x < width) {
-        uint8_t index = (((*rowBuffer) >> pixelShift) & bitMask);
-        while (xError > 0) {
-            *screenPointer = palette[index];
-            screenPointer++;
-            xError -= width;
-        }
-        while (xError <= 0) {
-            if (pixelShift < bitsPerPixel) {
-                rowBuffer++;
-                pixelShift = 8 - bitsPerPixel;
+// Decodes the next row of a run length encoded bitmap into rowBuffer, one palette index per byte,
+// so that both RLE8 and RLE4 images can be drawn with displayIndexed8Row.
+// Pixels that the encoder skipped over (with an end of line, delta or end of bitmap escape) are left as index 0.
+bool rleDecodeRow(rleDecoder* decoder, uint8_t* rowBuffer, unsigned int width) {
+    unsigned int x = decoder->startX;
+    memset(rowBuffer, 0, width);
+    decoder->row++;
+    if (decoder->endOfBitmap) {
+        return true;
+    }
+    if (decoder->blankRows) {
+        decoder->blankRows--;
+        return true;
+    }
+    decoder->startX = 0;
+    while (true) {
+        uint8_t count;
+        uint8_t value;
+        if (!rleReadByte(decoder->reader, &count) || !rleReadByte(decoder->reader, &value)) {
+            return false;
+        }
+        if (count) {
+            // Encoded mode: repeat value count times
+            // (In RLE4 the two nibbles of value alternate)
+            if (x + count > width) {
+                count = (x < width) ? width - x : 0;
+            }
+            if (decoder->fourBit) {
+                for (uint8_t i = 0; i < count; i++) {
+                    rowBuffer[x + i] = (i & 1) ? (value & 0x0F) : (value >> 4);
+                }
             } else {
-                pixelShift -= bitsPerPixel;
+                memset(rowBuffer + x, value, count);
+            }
+            x += count;
+            continue;
+        }
+        switch (value) {
+            case 0:
+                // End of line
+                return true;
+            case 1:
+                // End of bitmap
+                decoder->endOfBitmap = true;
+                return true;
+            case 2: {
+                // Delta: move right by dx and down by dy
+                uint8_t dx;
+                uint8_t dy;
+                if (!rleReadByte(decoder->reader, &dx) || !rleReadByte(decoder->reader, &dy)) {
+                    return false;
+                }
+                x += dx;
+                if (dy) {
+                    decoder->blankRows = dy - 1;
+                    decoder->startX = x;
+                    return true;
+                }
+                break;
+            }
+            default: {
+                // Absolute mode: value literal pixels follow, padded out to a 16 bit boundary
+                unsigned int bytes = decoder->fourBit ? (value + 1)/2 : value;
+                for (unsigned int i = 0; i < bytes; i++) {
+                    uint8_t pixels;
+                    if (!rleReadByte(decoder->reader, &pixels)) {
+                        return false;
+                    }
+                    if (decoder->fourBit) {
+                        if (x < width) {
+                            rowBuffer[x] = pixels >> 4;
+                        }
+                        x++;
+                        if (i*2 + 1 < value) {
+                            if (x < width) {
+                                rowBuffer[x] = pixels & 0x0F;
+                            }
+                            x++;
+                        }
+                    } else {
+                        if (x < width) {
+                            rowBuffer[x] = pixels;
+                        }
+                        x++;
+                    }
+                }
+                if (bytes & 1) {
+                    uint8_t padding;
+                    if (!rleReadByte(decoder->reader, &padding)) {
+                        return false;
+                    }
+                }
+                break;
             }
-            xError += renderWidth;
-            x++;
         }
     }
 }
 
-// Takes a bitmap color table and converts it to a BGR 565 palette
-void generatePalette(unsigned int colors, uint8_t* colorTable, uint16_t* palette) {
-    for (unsigned int i = 0; i < colors; i++) {
-        ColorError err = 0;
-        palette[i] = rgb888to565(colorTable, &err);
-        colorTable += 4;
+// Everything needed to pull rows out of a bitmap file and draw them
+struct bitmapImage {
+    // File handle and the position of the input buffer in the file
+    bitmapReader reader;
+    // Whether the image is run length encoded (BI_RLE8 or BI_RLE4)
+    bool rle;
+    // State for decoding run length encoded images
+    rleDecoder decoder;
+    // Offset into the file of the pixel data
+    uint32_t dataOffset;
+    // How many bytes each row of the bitmap takes up
+    size_t rowSize;
+    // Dimensions of the image
+    unsigned int width;
+    unsigned int height;
+    // Bit depth of the image
+    uint8_t bitsPerPixel;
+    // How many bytes each pixel takes up
+    size_t bytesPerPixel;
+    // Display mode of the file
+    bppModes displayMode;
+    // Whether the pixels are BGR 1555 (and the LCD has been put into 1555 mode to match)
+    bool bgr1555;
+    // Whether the LCD is in 8bpp mode with the image's palette loaded, so indices get written to vram as they are.
+    // In this mode, the screen pointers handed around actually point to bytes of vram.
+    bool paletteMode = false;
+    // Buffer for holding a decoded row of a run length encoded image
+    // (everything else is drawn straight out of the input buffer)
+    uint8_t* rowBuffer = nullptr;
+    // Holds a pixel that's split between the end of the input buffer and the start of the next chunk of the file
+    uint8_t carry[4];
+    // Buffer for holding the palette
+    uint16_t* palette = nullptr;
+    // How many entries palette has
+    unsigned int paletteColors = 0;
+    // Byte to pixels table for 1, 2 and 4bpp images
+    uint16_t* packedTable = nullptr;
+    // Lookup tables for displayBitFieldRow
+    BitfieldTables* tables = nullptr;
+    // Where every rleCheckpointRows'th row of a run length encoded image starts,
+    // filled in as the rows get decoded so that they can be jumped back to later
+    rleCheckpoint* checkpoints = nullptr;
+    // How many of the checkpoints have been filled in
+    unsigned int checkpointCount = 0;
+};
+
+// How many bytes a run of pixels takes up
+size_t bitmapRunBytes(bitmapImage* image, unsigned int count) {
+    if (image->displayMode == indexed) {
+        return (count*image->bitsPerPixel)/8;
     }
+    return count*image->bytesPerPixel;
 }
 
-// Implement scaling later
-// Draws a row using the bitmasks in the BITMAPV4HEADER
-void displayBitFieldRow(uint8_t* trueRowBuffer, int width, unsigned int renderWidth, size_t bytesPerPixel, uint16_t* screenPointer, BitfieldMasks* mask) {
-    uint32_t* rowBuffer = reinterpret_cast<uint32_t*>(trueRowBuffer);
-    int xError = 0;
-    unsigned int x = 0;
-    while (x < width) {
-        uint16_t red;
-        uint16_t green;
-        uint16_t blue;
-        uint16_t alpha = 0;
-        uint16_t alphaMax = 0;
-        if (mask->alphaMask != 0) {
-            if (mask->alphaMaskShift <= 0) {
-                alpha = ((*rowBuffer) & mask->alphaMask) << abs(mask->alphaMaskShift);
-                alphaMax = mask->alphaMask << abs(mask->alphaMaskShift);
-            } else {
-                alpha = ((*rowBuffer) & mask->alphaMask) >> mask->alphaMaskShift;
-                alphaMax = mask->alphaMask >> mask->alphaMaskShift;
+// Decide how to draw the pixels
+// If the image is already in 5-6-5 BGR, copy the pixels to vram directly
+// Else, if the image is in RGB mode (it uses the corresponding standard pixel storage mode)
+// draw it using the simpler displayRGBRow function.
+// Else, if it the image is in BITFIELDS mode, and it's not a native image, draw it using the slower but more comprehensive
+// displayBitFieldRow function
+// width is how many pixels wide the row (or span of it) being scaled to renderWidth is
+uint16_t* bitmapDrawPixels(bitmapImage* image, uint8_t* pixels, unsigned int count, unsigned int width, unsigned int renderWidth, uint16_t* screenPointer,
+    RowState* state) {
+    switch (image->displayMode) {
+        case indexed:
+            return displayPackedRow(pixels, count, width, renderWidth, image->packedTable, 8/image->bitsPerPixel, screenPointer, state);
+        case indexed8:
+            if (image->paletteMode) {
+                return reinterpret_cast<uint16_t*>(displayIndexRow(pixels, count, width, renderWidth, reinterpret_cast<uint8_t*>(screenPointer), state));
             }
+            return displayIndexed8Row(pixels, count, width, renderWidth, image->palette, screenPointer, state);
+        case native:
+            return displayNativeRow(pixels, count, width, renderWidth, screenPointer, state);
+        case rgb888:
+            return displayRGBRow(pixels, count, width, renderWidth, screenPointer, state);
+        case rgba8888:
+            return displayRGBARow(pixels, count, width, renderWidth, screenPointer, state);
+        case bitfields:
+            return displayBitFieldRow(pixels, count, width, renderWidth, image->bytesPerPixel, image->tables, screenPointer, state);
+        default:
+            return screenPointer;
+    }
+}
+
+// Adds a run of pixels to the area averaging accumulators.
+// rgb888 and 565 pixels go straight in. Everything else is run through its normal kernel at 1:1 into strip first
+// (areaStripWidth pixels at a time), so the palette/bitfield/alpha handling doesn't need to be written twice.
+// The strip is only an intermediate step, so it's converted without the 2D dither modes; they only get applied when the
+// averages are resolved onto the screen.
+void bitmapAccumulatePixels(bitmapImage* image, uint8_t* pixels, unsigned int count, AreaState* area, uint16_t* strip) {
+    if (image->displayMode == rgb888) {
+        accumulateRGBRow(pixels, count, area);
+        return;
+    }
+    if (image->displayMode == native) {
+        accumulate565Row(reinterpret_cast<uint16_t*>(pixels), count, area);
+        return;
+    }
+    RowState state = {0, {}};
+    uint8_t mode = ditherPause();
+    while (count) {
+        unsigned int run = (count > areaStripWidth) ? areaStripWidth : count;
+        bitmapDrawPixels(image, pixels, run, image->width, image->width, strip, &state);
+        accumulate565Row(strip, run, area);
+        pixels += bitmapRunBytes(image, run);
+        count -= run;
+    }
+    ditherResume(mode);
+}
+
+// Draws a run of pixels, or adds it to the area averaging accumulators if area is set
+uint16_t* bitmapRunPixels(bitmapImage* image, uint8_t* pixels, unsigned int count, unsigned int width, unsigned int renderWidth, uint16_t* screenPointer,
+    RowState* state, AreaState* area, uint16_t* strip) {
+    if (area) {
+        bitmapAccumulatePixels(image, pixels, count, area, strip);
+        return screenPointer;
+    }
+    return bitmapDrawPixels(image, pixels, count, width, renderWidth, screenPointer, state);
+}
+
+// Gets the decoder ready to decode row y of a run length encoded image.
+// If the row has already been decoded (or there's a checkpoint between the decoder and the row), the decoder goes back to
+// the last checkpoint before the row, so at most rleCheckpointRows - 1 rows have to be decoded and thrown away.
+bool rleSeekRow(bitmapImage* image, unsigned int y) {
+    rleDecoder* decoder = &image->decoder;
+    if (!image->checkpointCount) {
+        return y >= decoder->row;
+    }
+    unsigned int index = y/rleCheckpointRows;
+    if (index >= image->checkpointCount) {
+        index = image->checkpointCount - 1;
+    }
+    if (y < decoder->row || index*rleCheckpointRows > decoder->row) {
+        rleCheckpoint* checkpoint = &image->checkpoints[index];
+        if (!bitmapSeek(&image->reader, checkpoint->offset)) {
+            return false;
         }
-        if (mask->redMaskShift <= 0) {
-            red = ((*rowBuffer) & mask->redMask) << abs(mask->redMaskShift + 11);
-        } else {
-            red = (((*rowBuffer) & mask->redMask) >> mask->redMaskShift) << 11;
+        decoder->row = index*rleCheckpointRows;
+        decoder->blankRows = checkpoint->blankRows;
+        decoder->startX = checkpoint->startX;
+        decoder->endOfBitmap = checkpoint->endOfBitmap;
+    }
+    return true;
+}
+
+// Draws count pixels of row y of the image, starting from column x, at screenPointer
+// (or adds them to the area averaging accumulators if area is set).
+// The pixels are handed to the kernels straight out of the input buffer, a run at a time,
+// so only a pixel that's split across two chunks of the file ever gets copied.
+// The span gets scaled from width pixels to renderWidth (so a whole row is scaled from image->width, and a window drawn at 1:1 uses count for both).
+// For 1, 2 and 4bpp images, x has to land on a byte boundary.
+bool bitmapRenderSpan(bitmapImage* image, unsigned int y, unsigned int x, unsigned int count, unsigned int width, unsigned int renderWidth,
+    uint16_t* screenPointer, AreaState* area, uint16_t* strip) {
+    RowState state = {0, {}};
+    unsigned int pixelsLeft = count;
+    uint8_t* inputPointer;
+    if (image->rle) {
+        // There's no way to find where a run length encoded row starts without decoding everything before it,
+        // so start from the closest checkpoint and decode (and throw away) any rows in between
+        if (!rleSeekRow(image, y)) {
+            return false;
         }
-        if (mask->greenMaskShift <= 0) {
-            green = ((*rowBuffer) & mask->greenMask) << abs(mask->greenMaskShift + 5);
-        } else {
-            green = (((*rowBuffer) & mask->greenMask) >> mask->greenMaskShift) << 5;
+        while (image->decoder.row <= y) {
+            if (image->checkpoints && image->decoder.row == image->checkpointCount*rleCheckpointRows) {
+                rleCheckpoint* checkpoint = &image->checkpoints[image->checkpointCount];
+                checkpoint->offset = static_cast<uint32_t>(image->reader.bufferBlock)*FAT_BLOCK_SIZE + (image->reader.inputPointer - image->reader.buffer);
+                checkpoint->blankRows = image->decoder.blankRows;
+                checkpoint->startX = image->decoder.startX;
+                checkpoint->endOfBitmap = image->decoder.endOfBitmap;
+                image->checkpointCount++;
+            }
+            if (!rleDecodeRow(&image->decoder, image->rowBuffer, image->width)) {
+                return false;
+            }
         }
-        if (mask->blueMaskShift <= 0) {
-            blue = ((*rowBuffer) & mask->blueMask) << abs(mask->blueMaskShift);
+        bitmapRunPixels(image, image->rowBuffer + x, count, width, renderWidth, screenPointer, &state, area, strip);
+        return true;
+    }
+    if (!bitmapSeek(&image->reader, image->dataOffset + static_cast<uint32_t>(y)*image->rowSize + bitmapRunBytes(image, x))) {
+        return false;
+    }
+    inputPointer = image->reader.inputPointer;
+    // Give the USB driver a chance to keep the next chunk coming in
+    pumpReads();
+    while (pixelsLeft) {
+        // Hand over every whole pixel that's left in the input buffer
+        unsigned int run;
+        if (image->displayMode == indexed) {
+            run = (image->reader.bufferEnd - inputPointer)*(8/image->bitsPerPixel);
         } else {
-            blue = ((*rowBuffer) & mask->blueMask) >> mask->blueMaskShift;
+            run = (image->reader.bufferEnd - inputPointer)/image->bytesPerPixel;
         }
-        if (alpha != alphaMax) {
-            red = (red * alpha)/alphaMax;
-            green = (green * alpha)/alphaMax;
-            blue = (blue * alpha)/alphaMax;
+        if (run > pixelsLeft) {
+            run = pixelsLeft;
         }
-        while (xError > 0) {
-            *screenPointer = red + green + blue;
-            screenPointer++;
-            xError -= width;
+        if (run > maxRunLength) {
+            run = maxRunLength;
         }
-        while (xError <= 0) {
-            trueRowBuffer += bytesPerPixel;
-            rowBuffer = reinterpret_cast<uint32_t*>(trueRowBuffer);
-            xError += renderWidth;
-            x++;
+        if (run) {
+            screenPointer = bitmapRunPixels(image, inputPointer, run, width, renderWidth, screenPointer, &state, area, strip);
+            inputPointer += bitmapRunBytes(image, run);
+            pixelsLeft -= run;
+            continue;
+        }
+        // We've hit the end of the input buffer, possibly partway through a pixel.
+        // Save what there is of the pixel, load the next chunk, and finish the pixel off from that.
+        size_t partial = image->reader.bufferEnd - inputPointer;
+        memcpy(image->carry, inputPointer, partial);
+        if (!bitmapRefill(&image->reader)) {
+            return false;
+        }
+        inputPointer = image->reader.buffer;
+        if (partial) {
+            memcpy(image->carry + partial, inputPointer, image->bytesPerPixel - partial);
+            inputPointer += image->bytesPerPixel - partial;
+            screenPointer = bitmapRunPixels(image, image->carry, 1, width, renderWidth, screenPointer, &state, area, strip);
+            pixelsLeft--;
         }
     }
+    image->reader.inputPointer = inputPointer;
+    return true;
+}
+
+// How many blocks get read straight into vram between checks for a key press
+#define directReadBlocks 30
+
+// A 320x240 top-down 16bpp image is laid out exactly like vram, so its pixels can be read straight off the drive into vram.
+// Only the block the pixels start partway through (shared with the headers) and the last one (which would run off the end of vram)
+// go through the input buffer.
+// Sets bytesDone to how much of the frame got filled in, which is less than all of it if a key was pressed.
+bool bitmapReadToVram(bitmapImage* image, size_t* bytesDone) {
+    const size_t frameSize = 320*240*sizeof(uint16_t);
+    uint8_t* screen = reinterpret_cast<uint8_t*>(vram);
+    size_t offset = image->dataOffset % FAT_BLOCK_SIZE;
+    size_t done = 0;
+    *bytesDone = 0;
+    if (offset) {
+        if (!bitmapSeek(&image->reader, image->dataOffset)) {
+            return false;
+        }
+        done = FAT_BLOCK_SIZE - offset;
+        memcpy(screen, image->reader.inputPointer, done);
+    }
+    // From here on, the file gets read from without going through the reader
+    waitForReads();
+    image->reader.filled = false;
+    if (!seekFile(image->reader.handle, (image->dataOffset + done)/FAT_BLOCK_SIZE, set)) {
+        return false;
+    }
+    while (frameSize - done >= FAT_BLOCK_SIZE) {
+        if (os_GetCSC()) {
+            *bytesDone = done;
+            return true;
+        }
+        size_t blocks = (frameSize - done)/FAT_BLOCK_SIZE;
+        if (blocks > directReadBlocks) {
+            blocks = directReadBlocks;
+        }
+        if (!readFile(image->reader.handle, blocks, screen + done)) {
+            return false;
+        }
+        done += blocks*FAT_BLOCK_SIZE;
+    }
+    if (done < frameSize) {
+        if (!readFile(image->reader.handle, 1, inputBuffer)) {
+            return false;
+        }
+        memcpy(screen + done, inputBuffer, frameSize - done);
+        done = frameSize;
+    }
+    *bytesDone = done;
+    return true;
+}
+
+// Draws row y of the image at screenPointer (or adds it to the area averaging accumulators if area is set)
+bool bitmapRenderRow(bitmapImage* image, unsigned int y, unsigned int renderWidth, uint16_t* screenPointer, AreaState* area, uint16_t* strip) {
+    return bitmapRenderSpan(image, y, 0, image->width, image->width, renderWidth, screenPointer, area, strip);
+}
+
+// Draws a rows by columns piece of the image at 1:1, with its top left corner at (x, y) in the image (counting rows from the top of the image)
+// and at screenPointer in vram. The rows are read in the order they're stored in the file.
+bool bitmapDrawWindow(bitmapImage* image, bool topDown, unsigned int x, unsigned int y, unsigned int columns, unsigned int rows, uint16_t* screenPointer) {
+    for (unsigned int i = 0; i < rows; i++) {
+        unsigned int row = topDown ? i : rows - 1 - i;
+        unsigned int fileRow = topDown ? y + row : image->height - 1 - (y + row);
+        if (!bitmapRenderSpan(image, fileRow, x, columns, columns, columns, screenPointer + (row*320), nullptr, nullptr)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Shows the image at 1:1, starting from the middle, and lets the user scroll around it with the arrow keys.
+// Only the strip of the image that scrolls into view gets read from the file; the rest of the view is just moved over in vram.
+// Returns once any other key is pressed.
+bool bitmapPanView(bitmapImage* image, bool topDown) {
+    unsigned int viewWidth = (image->width < 320) ? image->width : 320;
+    unsigned int viewHeight = (image->height < 240) ? image->height : 240;
+    // 1, 2 and 4bpp images can only be drawn starting from a byte boundary
+    unsigned int align = (image->displayMode == indexed) ? 8 : 1;
+    unsigned int maxX = ((image->width - viewWidth)/align)*align;
+    unsigned int maxY = image->height - viewHeight;
+    unsigned int viewX = ((maxX/2)/align)*align;
+    unsigned int viewY = maxY/2;
+    uint16_t* viewTopLeft = vram + (((240 - viewHeight)/2)*320) + ((320 - viewWidth)/2);
+    // The view gets drawn in 16bpp, so switch back if the image was drawn in 8bpp
+    if (image->paletteMode) {
+        use16bppMode(false);
+        image->paletteMode = false;
+    }
+    clearBorders(viewTopLeft, viewWidth, viewHeight);
+    if (!bitmapDrawWindow(image, topDown, viewX, viewY, viewWidth, viewHeight, viewTopLeft)) {
+        return false;
+    }
+    while (true) {
+        unsigned int newX = viewX;
+        unsigned int newY = viewY;
+        switch (os_GetCSC()) {
+            case 0:
+                continue;
+            case sk_Left:
+                newX = (viewX > panStep) ? viewX - panStep : 0;
+                break;
+            case sk_Right:
+                newX = (viewX + panStep < maxX) ? viewX + panStep : maxX;
+                break;
+            case sk_Up:
+                newY = (viewY > panStep) ? viewY - panStep : 0;
+                break;
+            case sk_Down:
+                newY = (viewY + panStep < maxY) ? viewY + panStep : maxY;
+                break;
+            default:
+                return true;
+        }
+        if (newX > viewX) {
+            // Move everything left, then fill in the strip on the right
+            unsigned int dx = newX - viewX;
+            for (unsigned int row = 0; row < viewHeight; row++) {
+                memmove(viewTopLeft + (row*320), viewTopLeft + (row*320) + dx, (viewWidth - dx)*sizeof(uint16_t));
+            }
+            if (!bitmapDrawWindow(image, topDown, viewX + viewWidth, viewY, dx, viewHeight, viewTopLeft + (viewWidth - dx))) {
+                return false;
+            }
+        } else if (newX < viewX) {
+            // Move everything right, then fill in the strip on the left
+            unsigned int dx = viewX - newX;
+            for (unsigned int row = 0; row < viewHeight; row++) {
+                memmove(viewTopLeft + (row*320) + dx, viewTopLeft + (row*320), (viewWidth - dx)*sizeof(uint16_t));
+            }
+            if (!bitmapDrawWindow(image, topDown, newX, viewY, dx, viewHeight, viewTopLeft)) {
+                return false;
+            }
+        } else if (newY > viewY) {
+            // Move everything up, then fill in the rows at the bottom.
+            // The columns on either side of the view are black in every row, so whole rows of vram can be moved at once.
+            unsigned int dy = newY - viewY;
+            memmove(viewTopLeft, viewTopLeft + (dy*320), (viewHeight - dy)*320*sizeof(uint16_t));
+            if (!bitmapDrawWindow(image, topDown, viewX, viewY + viewHeight, viewWidth, dy, viewTopLeft + ((viewHeight - dy)*320))) {
+                return false;
+            }
+        } else if (newY < viewY) {
+            // Move everything down, then fill in the rows at the top
+            unsigned int dy = viewY - newY;
+            memmove(viewTopLeft + (dy*320), viewTopLeft, (viewHeight - dy)*320*sizeof(uint16_t));
+            if (!bitmapDrawWindow(image, topDown, viewX, newY, viewWidth, dy, viewTopLeft)) {
+                return false;
+            }
+        }
+        viewX = newX;
+        viewY = newY;
+    }
 }
 
 // Assumes that init_USB has already been callled
-bool displayBitmap(const char* path, const char* name) {
-    // File handle
-    fat_file_t* bitmapFile;
+bool displayBitmap(const char* path, const char* name, bool interactive) {
+    // The file, and everything needed to pull rows out of it
+    bitmapImage image;
     // Pointer to our current location in the buffer
     uint8_t* inputPointer;
     // Bitmap file header
@@ -146,20 +714,12 @@ bool displayBitmap(const char* path, const char* name) {
     // If not, it is assumed to only be BITMAPINFOHEADER compatible.
     // Any header smaller than the BITMAPINFOHEADER is assumed to not be compatible with the BITMAPINFOHEADER and thus will not be supported.
     bool v4Header;
-    // How many bytes each pixel takes up
-    size_t bytesPerPixel;
-    // How many bytes each row of the bitmap takes up
-    size_t rowSize;
-    // Buffer for holding a complete row from the image
-    uint8_t* rowBuffer;
-    // Buffer for holding the palette
-    uint16_t* palette = nullptr;
-    // Display mode of the file
-    bppModes displayMode;
     // A pointer to our current position in vram
     uint16_t* screenPointer;
     // How many pixels to offset each row in vram by
     int rowOffset;
+    // The top left corner of the image in vram
+    uint16_t* imageTopLeft;
     // Dimensions to scale the image to
     unsigned int renderWidth;
     unsigned int renderHeight;
@@ -169,23 +729,43 @@ bool displayBitmap(const char* path, const char* name) {
     // Used for scaling on the y axis
     int yError = 0;
     unsigned int y = 0;
-    // Settings for displayBitFieldRow
-    BitfieldMasks mask;
-
+    // Whether the image is being drawn with area averaging
+    bool areaScaling;
+    // Whether the image is being drawn with the LCD in 8bpp mode
+    bool palette8;
+    // Whether a key was pressed before the image was finished
+    bool interrupted = false;
+    // Whether the image came out of the frame cache instead of being drawn
+    bool frameLoaded = false;
+    // Whether the image was read straight into vram
+    bool directRead = false;
+    // Whether ditherStart has been called (so ditherEnd needs to be)
+    bool dithering = false;
+    // Buffers for area averaging
+    uint8_t* counts = nullptr;
+    AreaAccumulator* accumulator = nullptr;
+    uint16_t* strip = nullptr;
 
     // There are almost certainly more edge cases that need to be checked for
 
     // Open the bitmap file for reading.
     // If the file fails to open, return.
-    bitmapFile = openFile(path, name, false);
-    if (!bitmapFile) {
+    image.reader.handle = openFile(path, name, false);
+    if (!image.reader.handle) {
         return false;
     }
-    if (!readFile(bitmapFile, inputBufferSize/FAT_BLOCK_SIZE, inputBuffer)) {
+    // The headers (and the palette) all fit in the first half of the input buffer
+    if (!readFile(image.reader.handle, inputHalfBlocks, inputBuffer)) {
         os_PutStrFull(" !Read failed.!");
-        closeFile(bitmapFile);
+        closeFile(image.reader.handle);
         return false;
     }
+    image.reader.bufferBlock = 0;
+    image.reader.filled = true;
+    image.reader.buffer = inputBuffer;
+    image.reader.bufferEnd = inputBuffer + inputHalfSize;
+    bitmapPrefetch(&image.reader);
+    image.bgr1555 = false;
     inputPointer = inputBuffer;
 
     // We're going to destroy the input buffer in the future, so if we want to be able to take values from the header later, we need to save it
@@ -195,7 +775,7 @@ bool displayBitmap(const char* path, const char* name) {
     // Work around for the fact that we're reading the bfType as an LE int, when really it's 2 chars, one after the other
     if (fileHeader.bfType != 'MB') {
         os_PutStrFull(" !Magic bytes are wrong!");
-        closeFile(bitmapFile);
+        closeFile(image.reader.handle);
         return false;
     }
     inputPointer += sizeof(bitmapFileHeader);
@@ -205,120 +785,162 @@ bool displayBitmap(const char* path, const char* name) {
     DIBheader = *(reinterpret_cast<bitmapInfoHeader*>(inputPointer));
     if (DIBheader.biSize < 40) {
         os_PutStrFull(" !DIB header too small!");
-        closeFile(bitmapFile);
+        closeFile(image.reader.handle);
         return false;
     }
     inputPointer += DIBheader.biSize;
     v4Header = DIBheader.biSize >= 108;
-    if (DIBheader.biCompression != BI_RGB && DIBheader.biCompression != BI_BITFIELDS) {
+    if (DIBheader.biCompression != BI_RGB && DIBheader.biCompression != BI_BITFIELDS && DIBheader.biCompression != BI_RLE8 && DIBheader.biCompression != BI_RLE4) {
         os_PutStrFull(" !Compression mode wrong!");
-        closeFile(bitmapFile);
+        closeFile(image.reader.handle);
+        return false;
+    }
+    image.rle = DIBheader.biCompression == BI_RLE8 || DIBheader.biCompression == BI_RLE4;
+    // RLE8 only goes with 8bpp, RLE4 only goes with 4bpp, and neither can be stored top-down
+    if (image.rle && (DIBheader.biHeight < 0 || DIBheader.biBitCount != ((DIBheader.biCompression == BI_RLE8) ? 8 : 4))) {
+        os_PutStrFull(" !Compression mode or bit depth wrong!");
+        closeFile(image.reader.handle);
         return false;
     }
     if (DIBheader.biCompression == BI_BITFIELDS && !v4Header) {
         os_PutStrFull(" !Compression mode or header type wrong!");
-        closeFile(bitmapFile);
+        closeFile(image.reader.handle);
         return false;
     }
-    bytesPerPixel = DIBheader.biBitCount/8;
+    // Run length encoded rows get decoded to one byte per pixel
+    image.bytesPerPixel = image.rle ? 1 : DIBheader.biBitCount/8;
 
     // This weird math is to account for the fact that each row is padded to be a multiple of 4 bytes long
-    rowSize = (((DIBheader.biBitCount*DIBheader.biWidth)+31)/32)*4;
+    image.rowSize = (((DIBheader.biBitCount*DIBheader.biWidth)+31)/32)*4;
 
     switch (DIBheader.biBitCount) {
         case 1:
         case 2:
         case 4:
         case 8:
-            if (DIBheader.biCompression != BI_RGB) {
+            if (DIBheader.biCompression != BI_RGB && !image.rle) {
                 os_PutStrFull(" !Unsupported bit depth!");
-                closeFile(bitmapFile);
+                closeFile(image.reader.handle);
                 return false;
             }
-            rowBuffer = new uint8_t[rowSize];
-            if (DIBheader.biClrUsed == 0) {
-                palette = new uint16_t[1 << DIBheader.biBitCount];
-                generatePalette(1 << DIBheader.biBitCount, inputPointer, palette);
-            } else {
-                palette = new uint16_t[DIBheader.biClrUsed];
-                generatePalette(DIBheader.biClrUsed, inputPointer, palette);
+            {
+                unsigned int colors = DIBheader.biClrUsed ? DIBheader.biClrUsed : (1 << DIBheader.biBitCount);
+                image.palette = static_cast<uint16_t*>(arenaAlloc(&imageArena, colors*sizeof(uint16_t)));
+                if (image.palette == nullptr) {
+                    os_PutStrFull(" !Failed to allocate the palette!");
+                    closeFile(image.reader.handle);
+                    return false;
+                }
+                generatePalette(colors, inputPointer, image.palette);
+                image.paletteColors = colors;
             }
-            if (DIBheader.biBitCount == 8) { 
-                displayMode = indexed8;
+            if (DIBheader.biBitCount == 8 || image.rle) { 
+                image.displayMode = indexed8;
             } else {
-                displayMode = indexed;
+                image.displayMode = indexed;
+                // Each entry holds 8/bitsPerPixel pixels
+                image.packedTable = static_cast<uint16_t*>(arenaAlloc(&imageArena, 256*(8/DIBheader.biBitCount)*sizeof(uint16_t)));
+                if (image.packedTable == nullptr) {
+                    os_PutStrFull(" !Failed to allocate the palette table!");
+                    arenaReset(&imageArena);
+                    closeFile(image.reader.handle);
+                    return false;
+                }
+                generatePackedTable(DIBheader.biBitCount, image.paletteColors, image.palette, image.packedTable);
             }
             break;
         case 16:
-            rowBuffer = new uint8_t[rowSize];
             if (DIBheader.biCompression == BI_RGB || (DIBheader.bV4RedMask == 0x7c00 && DIBheader.bV4GreenMask == 0x3e0 && DIBheader.bV4BlueMask == 0x1f)) {
-                // set display to BGR1555 mode
-                *(reinterpret_cast<uint8_t*>(0xE30018)) = (*(reinterpret_cast<uint8_t*>(0xE30018)) & 0xF1) | 0x8;
-                displayMode = native;
+                // The display gets set to BGR1555 mode to match, just before the image is drawn
+                image.displayMode = native;
+                image.bgr1555 = true;
             } else if (DIBheader.bV4RedMask == 0xf800 && DIBheader.bV4GreenMask == 0x7e0 && DIBheader.bV4BlueMask == 0x1f) {
-                displayMode = native;
+                image.displayMode = native;
             } else {
-                displayMode = bitfields;
+                image.displayMode = bitfields;
             }
             break;
         case 24:
-            rowBuffer = new uint8_t[rowSize];
             if (DIBheader.biCompression == BI_RGB || (DIBheader.bV4RedMask == 0xFF0000 && DIBheader.bV4GreenMask == 0xFF00 && DIBheader.bV4BlueMask == 0xFF)) {
-                displayMode = rgb888;
+                image.displayMode = rgb888;
             } else {
-                displayMode = bitfields;
+                image.displayMode = bitfields;
             }
             break;
         case 32:
-            rowBuffer = new uint8_t[rowSize];
             if (DIBheader.biCompression == BI_RGB || (DIBheader.bV4AlphaMask == 0xFF000000 && DIBheader.bV4RedMask == 0xFF0000 && DIBheader.bV4GreenMask == 0xFF00 && DIBheader.bV4BlueMask == 0xFF)) {
-                displayMode = rgba8888;
+                image.displayMode = rgba8888;
             } else {
-                displayMode = bitfields;
+                image.displayMode = bitfields;
             }
             break;
         default:
             os_PutStrFull(" !Unsupported bit depth!");
-            closeFile(bitmapFile);
+            closeFile(image.reader.handle);
             return false;
     }
 
-    // Check that rowBuffer actually got allocated
-    if (rowBuffer == nullptr) {
-        os_PutStrFull(" !Failed to allocate the row buffer!");
-        closeFile(bitmapFile);
-        return false;
+    // Run length encoded rows need somewhere to be decoded to
+    if (image.rle) {
+        image.rowBuffer = static_cast<uint8_t*>(arenaAlloc(&imageArena, DIBheader.biWidth));
+        if (image.rowBuffer == nullptr) {
+            os_PutStrFull(" !Failed to allocate the row buffer!");
+            arenaReset(&imageArena);
+            closeFile(image.reader.handle);
+            return false;
+        }
     }
 
-    // If using bitfields mode, initialize the masks for displayBitFieldsRow
-    if (displayMode == bitfields) {
-        mask.redMask = DIBheader.bV4RedMask;
-        mask.redMaskShift = findBitMaskShift(DIBheader.bV4RedMask);
-        mask.greenMask = DIBheader.bV4GreenMask;
-        mask.greenMaskShift = findBitMaskShift(DIBheader.bV4GreenMask) - 1;
-        mask.blueMask = DIBheader.bV4BlueMask;
-        mask.blueMaskShift = findBitMaskShift(DIBheader.bV4BlueMask);
-        mask.alphaMask = DIBheader.bV4AlphaMask;
-        mask.alphaMaskShift = findBitMaskShift(DIBheader.bV4AlphaMask);
+    // If using bitfields mode, build the lookup tables for displayBitFieldRow
+    if (image.displayMode == bitfields) {
+        image.tables = static_cast<BitfieldTables*>(arenaAlloc(&imageArena, sizeof(BitfieldTables)));
+        if (image.tables == nullptr) {
+            os_PutStrFull(" !Failed to allocate the bitfield tables!");
+            arenaReset(&imageArena);
+            closeFile(image.reader.handle);
+            return false;
+        }
+        generateBitfieldChannel(DIBheader.bV4BlueMask, image.bytesPerPixel, 0, &image.tables->blue);
+        generateBitfieldChannel(DIBheader.bV4GreenMask, image.bytesPerPixel, 0, &image.tables->green);
+        generateBitfieldChannel(DIBheader.bV4RedMask, image.bytesPerPixel, 0, &image.tables->red);
+        // Images without an alpha channel are opaque
+        generateBitfieldChannel(DIBheader.bV4AlphaMask, image.bytesPerPixel, 255, &image.tables->alpha);
     }
 
-    // Set input pointer to point to the start of bitmap data
-    inputPointer = inputBuffer + fileHeader.bfOffBits;
+    image.width = DIBheader.biWidth;
+    image.height = abs_long(DIBheader.biHeight);
+    image.bitsPerPixel = DIBheader.biBitCount;
+    image.dataOffset = fileHeader.bfOffBits;
+
+    // Run length encoded data can only be read from start to finish, so start at the beginning of it
+    if (image.rle) {
+        if (!bitmapSeek(&image.reader, fileHeader.bfOffBits)) {
+            goto readError;
+        }
+        image.decoder.reader = &image.reader;
+        image.decoder.fourBit = DIBheader.biCompression == BI_RLE4;
+        image.decoder.endOfBitmap = false;
+        image.decoder.row = 0;
+        image.decoder.blankRows = 0;
+        image.decoder.startX = 0;
+        // If there isn't room for the checkpoints, the image just can't be zoomed into
+        image.checkpoints = static_cast<rleCheckpoint*>(arenaAlloc(&imageArena, ((image.height + rleCheckpointRows - 1)/rleCheckpointRows)*sizeof(rleCheckpoint)));
+    }
 
     // A pointer to our current position in vram
     screenPointer = (DIBheader.biHeight < 0) ? vram : vram + (320*239);
     rowOffset = (DIBheader.biHeight < 0) ? 320 : -320;
 
     // Figure out how we need to scale and reposition the image
-    if (DIBheader.biWidth == 320 && abs_long(DIBheader.biHeight) == 240) {
+    if (DIBheader.biWidth == 320 && image.height == 240) {
         renderWidth = 320;
         renderHeight = 240;
     } else {
         xRatio = 320.0f/static_cast<float>(DIBheader.biWidth);
-        yRatio = 240.0f/static_cast<float>(abs_long(DIBheader.biHeight));
+        yRatio = 240.0f/static_cast<float>(image.height);
         if (xRatio < yRatio) {
             renderWidth = 320;
-            renderHeight = static_cast<float>(abs_long(DIBheader.biHeight))*xRatio;
+            renderHeight = static_cast<float>(image.height)*xRatio;
             if (DIBheader.biHeight < 0) {
                 screenPointer += ((240-renderHeight)/2)*320;
             } else {
@@ -336,119 +958,296 @@ bool displayBitmap(const char* path, const char* name) {
             renderHeight = 240;
         }
     }
-    // Clear out screen before writing the final image
-    memset(vram, 0, (320*240)*sizeof(uint16_t));
+    imageTopLeft = (DIBheader.biHeight < 0) ? screenPointer : screenPointer - ((renderHeight - 1)*320);
+    // Area averaging only makes sense when the image is being shrunk.
+    // 1555 images are left out, since the averages come out as 565.
+    areaScaling = settings.scaling == areaAverage && !image.bgr1555 && image.width > renderWidth && image.height > renderHeight;
+    // 8bpp images can be drawn with the LCD in 8bpp mode (as long as they aren't being averaged or drawn progressively)
+    palette8 = settings.paletteOutput && image.displayMode == indexed8 && !areaScaling && !(settings.progressive && !image.rle);
+    // The file still gets opened and read up to here, so that the image can be zoomed into
+    if (loadCachedFrame(path, name)) {
+        frameLoaded = true;
+        image.paletteMode = palette8;
+        screenPointer = nullptr;
+        goto endOfImage;
+    }
+    if (drawOffScreen && !palette8) {
+        // Only 8bpp frames can be drawn without touching the one on screen, so leave this one for later
+        arenaReset(&imageArena);
+        closeFile(image.reader.handle);
+        return true;
+    }
+    if (!palette8) {
+        use16bppMode(image.bgr1555);
+        // Clear out the borders around the image before writing it.
+        // The image itself will be drawn over everything else, so there's no need to clear all of vram.
+        clearBorders(imageTopLeft, renderWidth, renderHeight);
+    }
+    ditherStart();
+    dithering = true;
 
-    while(!os_GetCSC()) {
-        // Incredibly wasteful -- Large images could be read much faster if we didn't read then discard so many rows
-        // Unfortunately, it seems FATDRVCE doesn't support efficiently seeking forward.
-        while (-yError >= renderHeight) {
-            // How many bytes are left to copy from the input buffer to the row buffer
-            unsigned int bytesRemainingInRow = rowSize;
-
-            // If the end of the row is outside the input buffer, copy what's in the input buffer and load the next chunk into the input buffer
-            while (inputPointer + bytesRemainingInRow > inputBufferEnd) {
-                bytesRemainingInRow -= inputBufferEnd - inputPointer;
-                inputPointer = inputBuffer;
-                if (!readFile(bitmapFile, inputBufferSize/FAT_BLOCK_SIZE, inputBuffer)) {
-                    os_PutStrFull(" !Read failed.!");
-                    if (palette) {
-                        delete[] palette;
-                    }
-                    delete[] rowBuffer;
-                    closeFile(bitmapFile);
-                    return false;
-                }
-            }
+    if (areaScaling) {
+        size_t areaMark = arenaMark(&imageArena);
+        counts = static_cast<uint8_t*>(arenaAlloc(&imageArena, renderWidth + 1));
+        accumulator = static_cast<AreaAccumulator*>(arenaAlloc(&imageArena, renderWidth*sizeof(AreaAccumulator)));
+        if (image.displayMode != rgb888 && image.displayMode != native) {
+            strip = static_cast<uint16_t*>(arenaAlloc(&imageArena, areaStripWidth*sizeof(uint16_t)));
+        }
+        if (counts == nullptr || accumulator == nullptr || (strip == nullptr && image.displayMode != rgb888 && image.displayMode != native) ||
+            !areaCountColumns(image.width, renderWidth, counts)) {
+            // Not enough memory (or the image is too big to average), so fall back to nearest neighbour
+            arenaRelease(&imageArena, areaMark);
+            counts = nullptr;
+            accumulator = nullptr;
+            strip = nullptr;
+        }
+    }
 
-            // Advance the pointer into the input buffer
-            inputPointer += bytesRemainingInRow;
-            yError += renderHeight;
-            y++;
-            if (y > abs_long(DIBheader.biHeight)) {
+    if (accumulator) {
+        // Every row of the image gets added into the accumulators for the screen row it lands on,
+        // and each screen row is drawn as soon as the last of its rows has been added.
+        AreaState state;
+        // Everything but rgb888 gets added up as 5-6-5
+        bool native565 = image.displayMode != rgb888;
+        unsigned int screenRow = 0;
+        unsigned int nextRowStart = areaRowStart(1, image.height, renderHeight);
+        memset(accumulator, 0, renderWidth*sizeof(AreaAccumulator));
+        while (!os_GetCSC()) {
+            if (y >= image.height) {
                 goto endOfImage;
             }
+            areaStartRow(&state, accumulator, counts);
+            if (!bitmapRenderRow(&image, y, renderWidth, nullptr, &state, strip)) {
+                goto readError;
+            }
+            y++;
+            if (y == nextRowStart) {
+                areaResolveRow(accumulator, counts, renderWidth, y - areaRowStart(screenRow, image.height, renderHeight), native565, screenPointer);
+                screenRow++;
+                nextRowStart = areaRowStart(screenRow + 1, image.height, renderHeight);
+                // Move up 1 row in vram
+                screenPointer += rowOffset;
+                if (screenRow >= renderHeight || screenPointer < vram || screenPointer + renderWidth > vram + (240*320)) {
+                    goto endOfImage;
+                }
+            }
         }
-        {
-            // A pointer to our current position on the row buffer
-            uint8_t* rowPointer = rowBuffer;
+        interrupted = true;
+        goto endOfImage;
+    }
 
-            // How many bytes are left to copy from the input buffer to the row buffer
-            unsigned int bytesRemainingInRow = rowSize;
+    // Images that are already exactly what vram holds skip the input buffer (and the kernels) altogether.
+    // This goes ahead of progressive mode, since nothing comes up faster than reading the file at the drive's full speed.
+    if (image.displayMode == native && image.width == 320 && image.height == 240 && DIBheader.biHeight < 0) {
+        size_t bytesDone;
+        if (!bitmapReadToVram(&image, &bytesDone)) {
+            goto readError;
+        }
+        if (bytesDone < 320*240*sizeof(uint16_t)) {
+            // Black out from the first row that didn't get finished
+            screenPointer = vram + (bytesDone/(320*sizeof(uint16_t)))*320;
+            interrupted = true;
+        } else {
+            screenPointer = nullptr;
+            // Reading it again is as fast as loading it from the frame cache, so there's no point saving it
+            directRead = true;
+        }
+        goto endOfImage;
+    }
 
-            // If the end of the row is outside the input buffer, copy what's in the input buffer and load the next chunk into the input buffer
-            while (inputPointer + bytesRemainingInRow > inputBufferEnd) {
-                memcpy(rowPointer, inputPointer, inputBufferEnd - inputPointer);
-                rowPointer += inputBufferEnd - inputPointer;
-                bytesRemainingInRow -= inputBufferEnd - inputPointer;
-                inputPointer = inputBuffer;
-                if (!readFile(bitmapFile, inputBufferSize/FAT_BLOCK_SIZE, inputBuffer)) {
-                    os_PutStrFull(" !Read failed.!");
-                    if (palette) {
-                        delete[] palette;
+    // Progressive mode draws the image in four passes, each one filling in the rows between the ones the last pass drew.
+    // Every 8th screen row gets drawn first and stretched over the 7 rows under it, so a rough version of the whole image
+    // shows up after reading only an 8th of the rows. Run length encoded images have to be decoded in order, so they're left out.
+    if (settings.progressive && !image.rle) {
+        // The first row each pass draws, how far apart the rows are, and how many rows each one gets stretched over
+        static const uint8_t passStart[] = {0, 4, 2, 1};
+        static const uint8_t passStep[] = {8, 8, 4, 2};
+        static const uint8_t passHeight[] = {8, 4, 2, 1};
+        bool topDown = DIBheader.biHeight < 0;
+        for (uint8_t pass = 0; pass < 4; pass++) {
+            if (passStart[pass] >= renderHeight) {
+                continue;
+            }
+            // Each pass goes through the rows in the order they're stored in the file (bottom to top for bottom-up images),
+            // so the reads keep moving forwards through the file instead of seeking back for every row
+            unsigned int passRows = (renderHeight - 1 - passStart[pass])/passStep[pass] + 1;
+            for (unsigned int i = 0; i < passRows; i++) {
+                unsigned int row = passStart[pass] + (topDown ? i : passRows - 1 - i)*passStep[pass];
+                uint16_t* rowPointer = imageTopLeft + (row*320);
+                if (os_GetCSC()) {
+                    // If the first pass didn't finish, black out the rows it didn't get to (everything from this row on, in the
+                    // order the pass was going). After that, every row has something in it.
+                    if (pass != 0) {
+                        screenPointer = nullptr;
+                    } else if (topDown) {
+                        screenPointer = rowPointer;
+                    } else {
+                        unsigned int lastRow = (row + passHeight[0] - 1 < renderHeight) ? row + passHeight[0] - 1 : renderHeight - 1;
+                        screenPointer = imageTopLeft + (lastRow*320);
                     }
-                    delete[] rowBuffer;
-                    closeFile(bitmapFile);
-                    return false;
+                    interrupted = true;
+                    goto endOfImage;
+                }
+                // Work out which row of the image lands on this row of the screen.
+                // Bottom-up images are stored with the bottom row of the screen first.
+                y = (static_cast<uint32_t>(topDown ? row : renderHeight - 1 - row)*image.height)/renderHeight;
+                if (!bitmapRenderRow(&image, y, renderWidth, rowPointer, nullptr, nullptr)) {
+                    goto readError;
+                }
+                // Stretch it over the rows the later passes haven't filled in yet
+                for (uint8_t i = 1; i < passHeight[pass] && row + i < renderHeight; i++) {
+                    memcpy(rowPointer + (i*320), rowPointer, renderWidth*sizeof(uint16_t));
                 }
             }
+        }
+        screenPointer = nullptr;
+        goto endOfImage;
+    }
 
-            // Copy the rest of the row from the input buffer
-            memcpy(rowPointer, inputPointer, bytesRemainingInRow);
-
-            // Advance the pointer into the input buffer
-            inputPointer += bytesRemainingInRow;
-            yError += renderHeight;
-            y++;
-            if (y > abs_long(DIBheader.biHeight)) {
-                goto endOfImage;
+    // 8bpp images can be drawn with the LCD in 8bpp mode instead, with the palette loaded into the LCD's palette RAM.
+    // The indices get copied straight to vram, so only half as much gets written, and 1:1 rows are just a block copy.
+    // Since a frame only takes up half of vram, the image is drawn into the half that isn't on screen,
+    // and the LCD gets flipped over to it once it's done, so the image shows up all at once.
+    if (palette8) {
+        uint8_t* page;
+        uint8_t* rowPointer;
+        // Only as many entries as the palette actually has get loaded (which is fewer than 256 for RLE4 and packed images)
+        unsigned int colors = (image.paletteColors < 256) ? image.paletteColors : 256;
+        // The borders get the first unused index (which setFramePalette makes black),
+        // or the darkest color if the palette is full
+        uint8_t black = colors;
+        if (colors == 256) {
+            unsigned int darkest = 0xFFFF;
+            for (unsigned int i = 0; i < colors; i++) {
+                uint16_t color = image.palette[i];
+                unsigned int level = (color >> 11) + ((color >> 6) & 0x1F) + (color & 0x1F);
+                if (level < darkest) {
+                    darkest = level;
+                    black = i;
+                }
             }
         }
-
-        // Decide how to draw the row
-        // If the image is already in 5-6-5 BGR, copy the pixels to vram directly
-        // Else, if the image is in RGB mode (it uses the corresponding standard pixel storage mode)
-        // draw it using the simpler displayRGBRow function.
-        // Else, if it the image is in BITFIELDS mode, and it's not a native image, draw it using the slower but more comprehensive
-        // displayBitFieldRow function
-        while (yError > 0) {
-            switch (displayMode) {
-                case indexed:
-                    displayIndexedRow(rowBuffer, DIBheader.biWidth, renderWidth, DIBheader.biBitCount, palette, screenPointer);
-                    break;
-                case indexed8:
-                    displayIndexed8Row(rowBuffer, DIBheader.biWidth, renderWidth, palette, screenPointer);
-                    break;
-                case native:
-                    displayNativeRow(rowBuffer, DIBheader.biWidth, renderWidth, screenPointer);
-                    break;
-                case rgb888:
-                    displayRGBRow(rowBuffer, DIBheader.biWidth, renderWidth, screenPointer);
-                    break;
-                case rgba8888:
-                    displayRGBARow(rowBuffer, DIBheader.biWidth, renderWidth, screenPointer);
-                    break;
-                case bitfields:
-                    displayBitFieldRow(rowBuffer, DIBheader.biWidth, renderWidth, bytesPerPixel, screenPointer, &mask);
-                    break;
-                default:
+        page = start8bppFrame(black);
+        // Offsets into vram carry straight over from 16bpp, just counting bytes instead of pixels
+        rowPointer = page + (screenPointer - vram);
+        setFramePalette(image.palette, colors);
+        image.paletteMode = true;
+        while (!os_GetCSC()) {
+            // Same as below, just a byte per pixel
+            while (-yError >= renderHeight) {
+                yError += renderHeight;
+                y++;
+            }
+            if (y >= image.height) {
+                goto paletteDone;
+            }
+            if (!bitmapRenderRow(&image, y, renderWidth, reinterpret_cast<uint16_t*>(rowPointer), nullptr, nullptr)) {
+                goto readError;
+            }
+            yError += renderHeight;
+            y++;
+            uint8_t* drawnRow = rowPointer;
+            while (true) {
+                rowPointer += rowOffset;
+                if (rowPointer < page || rowPointer + renderWidth > page + (240*320)) {
+                    goto paletteDone;
+                }
+                yError -= image.height;
+                if (yError <= 0) {
                     break;
+                }
+                memcpy(rowPointer, drawnRow, renderWidth);
             }
+        }
+        interrupted = true;
+        paletteDone:
+        // Anything that didn't get drawn is already black
+        finish8bppFrame(page);
+        screenPointer = nullptr;
+        goto endOfImage;
+    }
 
+    while(!os_GetCSC()) {
+        // Skip over the rows that won't be drawn.
+        // Rather than reading them in and throwing them away, we just work out where the next row we need starts
+        // and seek straight to it, so only the blocks holding rows that actually get drawn come off the drive.
+        while (-yError >= renderHeight) {
+            yError += renderHeight;
+            y++;
+        }
+        if (y >= image.height) {
+            goto endOfImage;
+        }
+        // Only the first copy of the row goes through the kernel.
+        // When the image is being stretched vertically, the rest are just copies of the finished row in vram.
+        if (!bitmapRenderRow(&image, y, renderWidth, screenPointer, nullptr, nullptr)) {
+            goto readError;
+        }
+        yError += renderHeight;
+        y++;
+        uint16_t* drawnRow = screenPointer;
+        while (true) {
             // Move up 1 row in vram
             screenPointer += rowOffset;
             if (screenPointer < vram || screenPointer + renderWidth > vram + (240*320)) {
                 goto endOfImage;
             }
-            yError -= abs_long(DIBheader.biHeight);
+            yError -= image.height;
+            if (yError <= 0) {
+                break;
+            }
+            memcpy(screenPointer, drawnRow, renderWidth*sizeof(uint16_t));
         }
     }
+    interrupted = true;
     endOfImage:
+    drawInterrupted = interrupted;
+    // Black out any rows of the image that didn't get drawn (because a key was pressed, or the image ran out a row early)
+    while (screenPointer >= imageTopLeft && screenPointer < imageTopLeft + (renderHeight*320)) {
+        memset(screenPointer, 0, renderWidth*sizeof(uint16_t));
+        screenPointer += rowOffset;
+    }
+    if (interactive) {
+        // Save the finished frame, so the image comes up straight away next time
+        if (!interrupted && !frameLoaded && !directRead) {
+            saveCachedFrame(path, name);
+        }
+        // Thumbnails are cached for good, so one of a half drawn image would never get replaced
+        if (!interrupted) {
+            captureThumbnail();
+        }
+        // Wait for the key that closes the image.
+        // If the image had to be shrunk to fit on the screen, the zoom key shows it at 1:1 instead.
+        uint8_t key;
+        while (!(key = os_GetCSC()));
+        if (key == sk_Zoom && (image.width > renderWidth || image.height > renderHeight) && (!image.rle || image.checkpoints)) {
+            if (!bitmapPanView(&image, DIBheader.biHeight < 0)) {
+                goto readError;
+            }
+        }
+    }
     // Remember to free that memory!
-    if (palette) {
-        delete[] palette;
+    arenaReset(&imageArena);
+    if (dithering) {
+        ditherEnd();
     }
-    delete[] rowBuffer;
-    closeFile(bitmapFile);
+    closeFile(image.reader.handle);
     return true;
+
+    readError:
+    // Off screen, the frame on screen has to be left alone (the slideshow throws the prepared page away, and the error
+    // comes up when the image gets drawn again on screen)
+    if (!drawOffScreen) {
+        // Put the LCD back the way the OS expects it, so the message can be seen
+        if (image.paletteMode) {
+            use16bppMode(false);
+        }
+        os_PutStrFull(" !Read failed.!");
+    }
+    arenaReset(&imageArena);
+    if (dithering) {
+        ditherEnd();
+    }
+    closeFile(image.reader.handle);
+    return false;
 }
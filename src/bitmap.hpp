@@ -1,6 +1,7 @@
 #pragma once
 #include <cstdint>
 #include <fatdrvce.h>
+#include "common.h"
 
 // i'm not gonna lie to ya: i'm just rewriting Microsoft's structs
 struct bitmapFileHeader {
@@ -38,6 +39,8 @@ struct bitmapInfoHeader {
 
 enum biCompressionMode {
     BI_RGB = 0,
+    BI_RLE8 = 1,
+    BI_RLE4 = 2,
     BI_BITFIELDS = 3
 };
 
@@ -50,15 +53,26 @@ enum bppModes {
     bitfields
 };
 
-struct BitfieldMasks {
-    uint32_t redMask;
-    uint32_t greenMask;
-    uint32_t blueMask;
-    uint32_t alphaMask;
-    int8_t redMaskShift;
-    int8_t greenMaskShift;
-    int8_t blueMaskShift;
-    int8_t alphaMaskShift;
+// Lookup tables for one channel of a BI_BITFIELDS image.
+// The top 8 bits (at most) of a channel always fit inside two neighbouring bytes of the pixel (the "window"),
+// so the channel's value (scaled to 0-255) is the sum of one entry from each table, in 8.8 fixed point.
+struct BitfieldChannel {
+    // Offset of the first byte of the window into the pixel
+    unsigned int offset;
+    // Contribution of the first byte of the window
+    uint16_t low[256];
+    // Contribution of the second byte of the window
+    uint16_t high[256];
 };
 
-bool displayBitmap(const char* path, const char* name);
\ No newline at end of file
+// Used by displayBitFieldRow
+struct BitfieldTables {
+    BitfieldChannel blue;
+    BitfieldChannel green;
+    BitfieldChannel red;
+    BitfieldChannel alpha;
+};
+
+// If interactive is set, waits for a key to be pressed before returning (as long as the image opened),
+// and lets the user zoom into the image in the meantime
+bool displayBitmap(const char* path, const char* name, bool interactive);
\ No newline at end of file
@@ -1,3 +0,0 @@
-section .data
-public _inputBuffer
-_inputBuffer: rb 32*512
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include <cstdlib>
+#include <cstdint>
+#include <fatdrvce.h>
+#include "common.h"
+#include "arena.hpp"
+
+// The input buffer always comes out of the heap.
+// The OS scratch areas (pixelShadow through saveSScreen, 0xD031F6-0xD13FD8) look free, but the toolchain links this program's .bss
+// and heap into that same range (from about 0xD052C6 up to 0xD13FD8), so a buffer put there would land on top of our own statics,
+// the arenas and everything else that gets allocated.
+
+// How big each of inputBufferSizes asks for. If there isn't that much memory, it settles for less (down to minBufferSize).
+static const size_t bufferSizes[] = {16*1024, 32*1024};
+#define minBufferSize (8*1024)
+
+uint8_t* inputBuffer = nullptr;
+size_t inputBufferSize = 0;
+
+// Reallocates the input buffer at one of inputBufferSizes, making it smaller if that's what it takes to leave keepFree bytes of heap.
+// Both halves of the buffer have to be a whole number of blocks, so the size is always a multiple of two blocks.
+// Returns false (leaving no buffer at all) if there isn't even minBufferSize to spare.
+bool placeInputBuffer(uint8_t size, size_t keepFree) {
+    // Give the old buffer back first, so its memory can go towards the new one
+    free(inputBuffer);
+    inputBuffer = nullptr;
+    inputBufferSize = 0;
+    size_t heap = heapLargestBlock();
+    size_t bytes = bufferSizes[size];
+    if (bytes + keepFree > heap) {
+        bytes = (heap > keepFree) ? (heap - keepFree) & ~static_cast<size_t>(2*FAT_BLOCK_SIZE - 1) : 0;
+    }
+    while (!inputBuffer && bytes >= minBufferSize) {
+        inputBuffer = static_cast<uint8_t*>(malloc(bytes));
+        if (!inputBuffer) {
+            bytes = (bytes/2) & ~static_cast<size_t>(2*FAT_BLOCK_SIZE - 1);
+        }
+    }
+    if (!inputBuffer) {
+        return false;
+    }
+    inputBufferSize = bytes;
+    return true;
+}
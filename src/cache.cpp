@@ -0,0 +1,141 @@
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include "cache.hpp"
+#include "screen.hpp"
+#include "common.h"
+#include "usb.h"
+
+// The first block of a frame file.
+// 8bpp frames follow it with a block holding the palette, then the pixels; 16bpp frames follow it with just the pixels.
+struct frameHeader {
+    char magic[4];
+    cacheKey key;
+    uint8_t format;
+};
+
+#define frameHeaderBlocks 1
+#define framePaletteBlocks 1
+#define frame8bppBlocks ((320*240)/FAT_BLOCK_SIZE)
+#define frame16bppBlocks ((320*240*2)/FAT_BLOCK_SIZE)
+
+// FNV-1a
+static uint32_t hashBytes(uint32_t hash, const void* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ static_cast<const uint8_t*>(data)[i])*16777619;
+    }
+    return hash;
+}
+
+uint32_t hashPath(const char* path) {
+    return hashBytes(2166136261, path, strlen(path));
+}
+
+// Looks up the name, size and modified date of an image (and the current settings, if withSettings is set)
+bool makeCacheKey(cacheKey* key, const char* path, const char* name, bool withSettings) {
+    memset(key, 0, sizeof(cacheKey));
+    key->pathHash = hashPath(path);
+    strncpy(key->name, name, 12);
+    if (withSettings) {
+        key->scaling = settings.scaling;
+        key->dither = settings.dither;
+        key->paletteOutput = settings.paletteOutput;
+    }
+    return getFileStamp(path, name, &key->size, &key->modified);
+}
+
+// Cache files are named after the hash of their key, since 8.3 names are too short for anything else
+void cacheFileName(char* fileName, const cacheKey* key, const char* extension) {
+    sprintf(fileName, "%08lX.%s", static_cast<unsigned long>(hashBytes(2166136261, key, sizeof(cacheKey))), extension);
+}
+
+// Opens a cache file for writing, making the cache directory first if it isn't there yet
+fat_file_t* createCacheFile(const char* fileName) {
+    if (!createDirectory(cacheParent, cacheDirName, true)) {
+        return nullptr;
+    }
+    return openFile(cacheDir, fileName, true);
+}
+
+bool loadCachedFrame(const char* path, const char* name) {
+#ifdef BENCHMARK
+    // Benchmarks are there to time the decoders
+    return false;
+#else
+    cacheKey key;
+    char fileName[13];
+    bool loaded = false;
+    if (!makeCacheKey(&key, path, name, true)) {
+        return false;
+    }
+    cacheFileName(fileName, &key, "FRM");
+    fat_file_t* file = openFile(cacheDir, fileName, false);
+    if (!file) {
+        return false;
+    }
+    uint8_t* block = new uint8_t[FAT_BLOCK_SIZE];
+    if (!block) {
+        closeFile(file);
+        return false;
+    }
+    frameHeader* header = reinterpret_cast<frameHeader*>(block);
+    if (readFile(file, frameHeaderBlocks, block) &&
+        memcmp(header->magic, "FR84", 4) == 0 && memcmp(&header->key, &key, sizeof(cacheKey)) == 0) {
+        if (header->format == frame8bpp) {
+            if (getSizeOf(file) == (frameHeaderBlocks + framePaletteBlocks + frame8bppBlocks)*FAT_BLOCK_SIZE) {
+                // Goes through the same page flipping as a freshly drawn 8bpp frame, so it can be loaded off screen too
+                uint8_t* page = start8bppFrame(0);
+                if (readFile(file, framePaletteBlocks, block)) {
+                    setFramePalette(reinterpret_cast<uint16_t*>(block), 256);
+                    loaded = readFile(file, frame8bppBlocks, page);
+                }
+                if (loaded) {
+                    finish8bppFrame(page);
+                }
+            }
+        } else if (!drawOffScreen && getSizeOf(file) == (frameHeaderBlocks + frame16bppBlocks)*FAT_BLOCK_SIZE) {
+            // The whole frame gets read straight into vram
+            use16bppMode(header->format == frame1555);
+            loaded = readFile(file, frame16bppBlocks, vram);
+        }
+    }
+    delete[] block;
+    closeFile(file);
+    return loaded;
+#endif
+}
+
+void saveCachedFrame(const char* path, const char* name) {
+    char fileName[13];
+    uint8_t format = shownFrameFormat();
+    unsigned int pixelBlocks = (format == frame8bpp) ? frame8bppBlocks : frame16bppBlocks;
+    unsigned int blocks = frameHeaderBlocks + ((format == frame8bpp) ? framePaletteBlocks : 0) + pixelBlocks;
+    uint8_t* block = new uint8_t[FAT_BLOCK_SIZE];
+    if (!block) {
+        return;
+    }
+    frameHeader* header = reinterpret_cast<frameHeader*>(block);
+    memset(block, 0, FAT_BLOCK_SIZE);
+    memcpy(header->magic, "FR84", 4);
+    header->format = format;
+    if (!makeCacheKey(&header->key, path, name, true)) {
+        delete[] block;
+        return;
+    }
+    cacheFileName(fileName, &header->key, "FRM");
+    fat_file_t* file = createCacheFile(fileName);
+    // The file gets sized once, then the header, the palette and the pixels are written out one after the other,
+    // with the pixels coming straight out of vram
+    bool good = setFileSize(file, blocks*FAT_BLOCK_SIZE) && writeFileBlocks(file, frameHeaderBlocks, block);
+    if (good && format == frame8bpp) {
+        getShownPalette(reinterpret_cast<uint16_t*>(block));
+        good = writeFileBlocks(file, framePaletteBlocks, block);
+    }
+    good = good && writeFileBlocks(file, pixelBlocks, shownFramePixels());
+    closeFile(file);
+    if (!good) {
+        // Don't leave half a frame lying around
+        deleteFile(cacheDir, fileName);
+    }
+    delete[] block;
+}
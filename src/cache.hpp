@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <fatdrvce.h>
+
+// The thumbnail and frame caches live in a hidden directory on the drive, so the file browser skips over it
+#define cacheParent "/"
+#define cacheDirName "B84CACHE"
+#define cacheDir "/B84CACHE"
+
+// What a cache entry was made from. If any of it changes, the entry is out of date.
+struct cacheKey {
+    uint32_t pathHash;
+    char name[13];
+    uint32_t size;
+    // As returned by getFileStamp
+    uint32_t modified;
+    // The settings that change how the image comes out (left as 0 for thumbnails, which are too small to tell)
+    uint8_t scaling;
+    uint8_t dither;
+    uint8_t paletteOutput;
+};
+
+uint32_t hashPath(const char* path);
+bool makeCacheKey(cacheKey* key, const char* path, const char* name, bool withSettings);
+void cacheFileName(char* fileName, const cacheKey* key, const char* extension);
+fat_file_t* createCacheFile(const char* fileName);
+
+// Draws the frame saved the last time the image was shown (if there is one), and returns whether it did
+bool loadCachedFrame(const char* path, const char* name);
+// Saves the frame on screen, so the image can be shown straight from it next time
+void saveCachedFrame(const char* path, const char* name);
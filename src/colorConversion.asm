@@ -5,7 +5,15 @@ public _rgb888to565
 ; sp[6-8]: Pointer to a ColorError struct
 ; Returns:
 ; hl: BGR565 triplet (for use with the calculator's display)
+; The dither mode is picked by ditherMode (set up by ditherStart):
+; Horizontal: ~430 cycles, carries the error on to the next pixel in the row
+; Floyd-Steinberg: ~1600 cycles, also spreads the error over the next row through ditherErrors
+; Ordered: ~620 cycles, adds a threshold from a 4x4 Bayer matrix instead of carrying any error
 _rgb888to565:
+    ; Check the dither mode
+    ld a, (_ditherMode) ; 20
+    or a, a ; 4
+    jp nz, dither_2d ; 17/16
     ; Init IY
     ld iy, 0 ; 20
     add iy, sp ; 8
@@ -64,6 +72,7 @@ blue_cont:
     sub a, e ; 4
     ld (hl), a ; 6
 
+pack_565:
     ; Load the red value into A
     ld a, c ; 4
     ; Load the green and blue values into HL
@@ -89,6 +98,212 @@ blue_cont:
     rr l ; 8
     ; Return
     ret ; 18
+
+; Start of the 2D dither modes
+; Works out which pixel of the row this is (and which row, if it's the first pixel), then goes to the code for the mode
+dither_2d:
+    ; Init IY
+    ld iy, 0 ; 20
+    add iy, sp ; 8
+    ; Save the pointer to the triplet for later
+    ld hl, (iy + 3) ; 24
+    push hl ; 10
+    ; Load the pointer to the ColorError struct into IY
+    ld iy, (iy + 6) ; 24
+    ; DE: x
+    ld de, (iy + 6) ; 24
+    ; If x is 0, this is the first pixel of the row, so give it the next row number
+    sbc hl, hl ; 8
+    adc hl, de ; 8
+    jr nz, dither_has_row ; 8/9
+    ld a, (_ditherRow) ; 20
+    ld (iy + 9), a ; 14
+    inc a ; 4
+    ld (_ditherRow), a ; 18
+dither_has_row:
+    ; Move on to the next pixel
+    inc hl ; 4
+    ld (iy + 6), hl ; 18
+    ld a, (_ditherMode) ; 20
+    cp a, orderedDither ; 8
+    jr z, ordered ; 8/9
+
+; Floyd-Steinberg
+; Each channel's error is spread 7/16 to the right, 3/16 down and to the left, 5/16 down and 1/16 down and to the right.
+; The errors are kept in 16ths, so none of it gets lost to rounding before it's used.
+floyd_steinberg:
+    ; Keep x inside the error buffer
+    ld hl, ditherColumns - 1 ; 16
+    or a, a ; 4
+    sbc hl, de ; 8
+    jr nc, floyd_steinberg_index ; 8/9
+    ld de, ditherColumns - 1 ; 16
+floyd_steinberg_index:
+    ; HL: this pixel's entry in the error buffer
+    ld hl, _ditherErrors + 3 ; 16
+    add hl, de ; 4
+    add hl, de ; 4
+    add hl, de ; 4
+    ; Load the RGB 888le triplet into A:DE
+    pop de ; 16
+    push hl ; 10
+    ex de, hl ; 4
+    ld e, (hl) ; 8
+    inc hl ; 4
+    ld d, (hl) ; 8
+    inc hl ; 4
+    ld a, (hl) ; 8
+    pop hl ; 16
+
+    ; Red
+    ld b, 248 ; 8
+    call fs_channel ; 32 + 264
+    push af ; 10
+    inc hl ; 4
+    inc iy ; 8
+
+    ; Green
+    ld a, d ; 4
+    ld b, 252 ; 8
+    call fs_channel ; 32 + 264
+    ld d, a ; 4
+    inc hl ; 4
+    inc iy ; 8
+
+    ; Blue
+    ld a, e ; 4
+    ld b, 248 ; 8
+    call fs_channel ; 32 + 264
+    ld e, a ; 4
+
+    pop af ; 16
+    ld c, a ; 4
+    jp pack_565 ; 17
+
+; Works out one channel of a pixel for Floyd-Steinberg, and spreads its error around
+; Input: A = channel value, B = mask for the channel's bits, HL = the channel in this pixel's entry in the error buffer,
+; IY = the channel in the ColorError struct
+; Output: A = channel value with the error added and the low bits cleared
+; Destroys C
+fs_channel:
+    ld c, a ; 4
+    ; Add the error from the pixel to the left and from the row above, rounded to a whole number
+    ld a, (iy + 0) ; 12
+    add a, (hl) ; 8
+    add a, 8 ; 8
+    rrca ; 4
+    rrca ; 4
+    rrca ; 4
+    rrca ; 4
+    and a, 15 ; 8
+    add a, c ; 4
+    jr nc, fs_channel_cont ; 8/9
+    sbc a, a ; 4
+fs_channel_cont:
+    ; C: channel value
+    ; A: channel value with the low bits cleared
+    ld c, a ; 4
+    and a, b ; 4
+    push af ; 10
+    ; C: error
+    sub a, c ; 4
+    neg ; 8
+    ld c, a ; 4
+    ; The pixel below gets 5/16, plus the 1/16 left over from the pixel to the left
+    add a, a ; 4
+    add a, a ; 4
+    add a, c ; 4
+    add a, (iy + 3) ; 12
+    ld (hl), a ; 6
+    ; Save 1/16 for the pixel below and to the right
+    ld (iy + 3), c ; 14
+    ; The pixel to the right gets 7/16
+    ld a, c ; 4
+    add a, a ; 4
+    add a, a ; 4
+    add a, a ; 4
+    sub a, c ; 4
+    ld (iy + 0), a ; 14
+    ; The pixel below and to the left gets 3/16
+    dec hl ; 4
+    dec hl ; 4
+    dec hl ; 4
+    ld a, c ; 4
+    add a, a ; 4
+    add a, c ; 4
+    add a, (hl) ; 8
+    ld (hl), a ; 6
+    inc hl ; 4
+    inc hl ; 4
+    inc hl ; 4
+    pop af ; 16
+    ret ; 18
+
+; Ordered
+; Adds a threshold from a 4x4 Bayer matrix (picked by the position of the pixel) to each channel before clearing the low bits
+ordered:
+    ; A: the pixel's position in the matrix (row*4 + column)
+    ld a, (iy + 9) ; 12
+    and a, 3 ; 8
+    add a, a ; 4
+    add a, a ; 4
+    ld b, a ; 4
+    ld a, e ; 4
+    and a, 3 ; 8
+    or a, b ; 4
+    ; IY: the thresholds for this pixel
+    add a, a ; 4
+    ld bc, 0 ; 16
+    ld c, a ; 4
+    ld iy, bayerThresholds ; 20
+    add iy, bc ; 8
+    ; Load the RGB 888le triplet into A:DE
+    pop hl ; 16
+    ld e, (hl) ; 8
+    inc hl ; 4
+    ld d, (hl) ; 8
+    inc hl ; 4
+    ld a, (hl) ; 8
+
+    add a, (iy + 0) ; 12
+    jr nc, ordered_red ; 8/9
+    sbc a, a ; 4
+ordered_red:
+    and a, 248 ; 8
+    ld c, a ; 4
+
+    ld a, d ; 4
+    add a, (iy + 1) ; 12
+    jr nc, ordered_green ; 8/9
+    sbc a, a ; 4
+ordered_green:
+    and a, 252 ; 8
+    ld d, a ; 4
+
+    ld a, e ; 4
+    add a, (iy + 0) ; 12
+    jr nc, ordered_blue ; 8/9
+    sbc a, a ; 4
+ordered_blue:
+    and a, 248 ; 8
+    ld e, a ; 4
+    jp pack_565 ; 17
+
+; The 4x4 Bayer matrix, scaled to the step between levels of a 5 bit channel and of a 6 bit channel
+bayerThresholds:
+    db 0, 0, 4, 2, 1, 0, 5, 2
+    db 6, 3, 2, 1, 7, 3, 3, 1
+    db 1, 0, 5, 2, 0, 0, 4, 2
+    db 7, 3, 3, 1, 6, 3, 2, 1
+
+; Must match ditherModes in common.h
+orderedDither equ 2
+; Must match the size of ditherErrors in dither.cpp (not counting the spare entry at the start)
+ditherColumns equ 320
+
+extern _ditherMode
+extern _ditherRow
+extern _ditherErrors
     
 section .text
 public _abs_long
@@ -1,9 +1,27 @@
+#pragma once
 #define vram ((uint16_t*)0xD40000)
-#define inputBufferSize (32*(FAT_BLOCK_SIZE))
 
 // Used by rgb888to565.
 // Should be zeroed out at the start of a row.
-typedef uint24_t ColorError;
+typedef struct {
+    // Error carried over to the next pixel (red, green, blue)
+    uint8_t error[3];
+    // Error carried over to the pixel below and to the right of the last one (only used by Floyd-Steinberg)
+    uint8_t below[3];
+    // How many pixels of the row have been converted so far
+    unsigned int x;
+    // Which row this is (handed out when the first pixel of the row gets converted)
+    uint8_t y;
+} ColorError;
+
+// Where a row kernel got up to, so the next run of pixels in the row can carry on from there.
+// Should be zeroed out at the start of a row.
+typedef struct {
+    // Used for scaling on the x axis
+    int xError;
+    // Used by rgb888to565
+    ColorError err;
+} RowState;
 
 #ifdef __cplusplus
 extern "C" {
@@ -17,7 +35,58 @@ void boot_InitializeHardware();
 #endif
 
 // We need to do some buffer shennanigans because we can only read a whole number of blocks from the file at a time.
-extern uint8_t inputBuffer[inputBufferSize];
+// How big it is gets picked at runtime by placeInputBuffer.
+extern uint8_t* inputBuffer;
+extern size_t inputBufferSize;
 
 // A pointer to the end of the input buffer
-#define inputBufferEnd (inputBuffer+inputBufferSize)
\ No newline at end of file
+#define inputBufferEnd (inputBuffer+inputBufferSize)
+
+// The input buffer gets split in two, so one half can be filled in the background while the other one's being decoded
+#define inputHalfSize (inputBufferSize/2)
+#define inputHalfBlocks (inputHalfSize/(FAT_BLOCK_SIZE))
+
+#ifdef __cplusplus
+// Ways of fitting an image to the screen
+enum scalingModes {
+    // Pick one source pixel for each screen pixel (fastest)
+    nearestNeighbour = 0,
+    // Average together every source pixel that lands on a screen pixel (smoother when shrinking)
+    areaAverage
+};
+
+// Ways of spreading out the error from converting to 5-6-5
+enum ditherModes {
+    // Carry the error on to the next pixel in the row
+    horizontalDither = 0,
+    // Spread the error over the next pixel and the row below
+    floydSteinberg,
+    // Add a threshold from a 4x4 Bayer matrix (no error gets carried)
+    orderedDither
+};
+
+// Sizes the input buffer can be.
+// It comes out of the heap, so a bigger one means fewer, larger reads but less memory for images.
+enum inputBufferSizes {
+    smallBuffer = 0,
+    largeBuffer
+};
+
+bool placeInputBuffer(uint8_t size, size_t keepFree);
+
+// Settings the user can change from the file browser
+struct viewerSettings {
+    uint8_t scaling;
+    uint8_t dither;
+    // Draw big bitmaps in passes, coarse to fine
+    uint8_t progressive;
+    // Show 8bpp bitmaps and grayscale JPEGs with the LCD in 8bpp mode
+    uint8_t paletteOutput;
+    // How long the slideshow shows each image for (an index into slideshowIntervals)
+    uint8_t slideshowInterval;
+    // How big the input buffer is (one of inputBufferSizes)
+    uint8_t bufferSize;
+};
+
+extern viewerSettings settings;
+#endif
\ No newline at end of file
@@ -0,0 +1,37 @@
+#include <cstring>
+#include <cstdint>
+#include "dither.hpp"
+#include "common.h"
+
+// Every pixel that gets converted ends up on the screen, so a row never has more than 320 of them
+#define ditherColumns 320
+
+extern "C" {
+    // Read by rgb888to565
+    uint8_t ditherMode = horizontalDither;
+    // The row number the next row to be converted gets
+    uint8_t ditherRow = 0;
+    // Floyd-Steinberg error waiting to be added to each pixel of the next row (red, green, blue), in 16ths.
+    // The spare entry at the start gives the first pixel of a row somewhere to put the error down and to the left of it.
+    uint8_t ditherErrors[(ditherColumns + 1)*3];
+}
+
+void ditherStart() {
+    ditherMode = settings.dither;
+    ditherRow = 0;
+    memset(ditherErrors, 0, sizeof(ditherErrors));
+}
+
+void ditherEnd() {
+    ditherMode = horizontalDither;
+}
+
+uint8_t ditherPause() {
+    uint8_t mode = ditherMode;
+    ditherMode = horizontalDither;
+    return mode;
+}
+
+void ditherResume(uint8_t mode) {
+    ditherMode = mode;
+}
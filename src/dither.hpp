@@ -0,0 +1,11 @@
+#pragma once
+#include <cstdint>
+
+// Gets rgb888to565 ready to convert an image, using the dither mode from the settings
+void ditherStart();
+// Puts rgb888to565 back to horizontal dithering (used for anything that isn't an image, like palettes)
+void ditherEnd();
+// Switches rgb888to565 to horizontal dithering for colors that aren't going straight to the screen,
+// leaving the Floyd-Steinberg errors and row numbers alone. Returns the mode to hand back to ditherResume.
+uint8_t ditherPause();
+void ditherResume(uint8_t mode);
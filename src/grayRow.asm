@@ -0,0 +1,149 @@
+assume adl=1
+section .text
+public _displayGrayRow
+; Arguments (C Convention):
+; uint8_t* pixels
+; unsigned int count (must be less than 65536)
+; unsigned int width
+; unsigned int renderWidth
+; uint16_t* screenPointer
+; RowState* state
+; Returns:
+; hl: screenPointer after the last pixel written
+; Draws 8 bit gray pixels
+_displayGrayRow:
+    ; Local variables:
+    ; int xError
+    ; unsigned int x
+    ; uint8_t color[3]
+    ; uint8_t* pixel
+    ; Init IX
+    push ix
+    ld ix, 0
+    add ix, sp
+
+    ; Make room on the stack for local variables
+    ld hl, -12
+    add hl, sp
+    ld sp, hl
+
+    ; Load xError from state
+    ld hl, (ix + state)
+    ld de, (hl)
+    ld (ix + xError), de
+
+    ; Push &state->err to the stack for rgb888to565
+    inc hl
+    inc hl
+    inc hl
+    push hl
+
+    ; Check that count > 0
+    ld de, (ix + count)
+    sbc hl, hl
+    adc hl, de
+
+    ; If count is 0, return
+    jr z, return
+
+    ; Init the registers
+    ld iy, (ix + pixels)
+    ld hl, (ix + xError)
+    ld bc, (ix + renderWidth)
+
+    ; If the first pixel doesn't get drawn (the last run of pixels ended partway through skipping), go straight to skipping
+    bit 7, (ix + xError + 2)
+    jr nz, skip_pixel
+
+fill_pixels:
+    ; Write x and pixel back to local variables
+    ld (ix + varX), de
+    ld (ix + varPixel), iy
+    ; Spread the gray level over all three channels of color
+    ld a, (iy)
+    ld (ix + varColor), a
+    ld (ix + varColor + 1), a
+    ld (ix + varColor + 2), a
+
+    ; Register allocation
+    ; HL: xError
+    ; DE: pixel
+    ; BC: width
+    ; IY: screenPointer
+    ; Get the pixel value
+    pea ix + varColor
+    call _rgb888to565
+    pop de
+    ; Init the registers
+    ex de, hl
+    ld hl, (ix + xError)
+    ld bc, (ix + width)
+    ld iy, (ix + screenPointer)
+    ; Clear the carry flag
+    or a, a
+fill_pixel_loop:
+    ; Write pixels while xError >= 0
+    ld (iy), e
+    ld (iy + 1), d
+    ; Increment screenPointer
+    lea iy, iy + 2
+    ; Update xError
+    sbc hl, bc
+    ; If no carry (xError did not wrap around from being positive to negative),
+    ; jump to the beginning of the loop
+    jr nc, fill_pixel_loop
+    ; Update screenPointer
+    ld (ix + screenPointer), iy
+    ; Register allocation
+    ; HL: xError
+    ; DE: x
+    ; BC: renderWidth
+    ; IY: pixels
+    ; Init the registers
+    ld de, (ix + varX)
+    ld bc, (ix + renderWidth)
+    ld iy, (ix + varPixel)
+skip_pixel:
+    ; While xError < 0, update x, pixels and xError
+    inc iy
+    dec de
+    ; Add renderWidth to xError
+    add hl, bc
+    ; If carry (xError wrapped around from being negative to positive), draw the next pixel
+    jr c, next_pixel
+    ; Otherwise, keep skipping pixels, as long as there are any left
+    ld a, d
+    or a, e
+    jr nz, skip_pixel
+    jr the_end
+next_pixel:
+    ; Update xError
+    ld (ix + xError), hl
+    ; Check if x is 0
+    ld a, d
+    or a, e
+    ; If it's not 0, jump to the beginning
+    jr nz, fill_pixels
+the_end:
+    ; Save xError for the next run of pixels
+    ld iy, (ix + state)
+    ld (iy), hl
+return:
+    ; Return screenPointer
+    ld hl, (ix + screenPointer)
+    ld sp, ix
+    pop ix
+    ret
+
+pixels equ 6
+count equ 9
+width equ 12
+renderWidth equ 15
+screenPointer equ 18
+state equ 21
+xError equ -3
+varX equ -6
+varColor equ -9
+varPixel equ -12
+
+extern _rgb888to565
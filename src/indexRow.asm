@@ -0,0 +1,154 @@
+assume adl=1
+section .text
+public _displayIndexRow
+; Arguments (C Convention):
+; uint8_t* pixels
+; unsigned int count (must be less than 65536)
+; unsigned int width
+; unsigned int renderWidth
+; uint8_t* screenPointer
+; RowState* state
+; Returns:
+; hl: screenPointer after the last pixel written
+; Copies 8bpp indices to vram as they are, for when the LCD is in 8bpp mode with the image's palette loaded
+_displayIndexRow:
+    ; Local variables:
+    ; unsigned int x
+    ; int xError
+    ; Init IX
+    push ix
+    ld ix, 0
+    add ix, sp
+
+    ; Make room on the stack for local variables
+    ld hl, -6
+    add hl, sp
+    ld sp, hl
+
+    ; Check that count > 0
+    ld de, (ix + count)
+    sbc hl, hl
+    adc hl, de
+
+    ; If count is 0, return
+    jr z, return
+
+    ; Check if width equals renderWidth
+    ld hl, (ix + width)
+    ld bc, (ix + renderWidth)
+    or a, a
+    sbc hl, bc
+
+    ; If width equals renderWidth, jump to the code for that
+    jr z, width_equ_renderWidth
+
+    ; Load xError from state
+    ld hl, (ix + state)
+    ld hl, (hl)
+    ld (ix + xError), hl
+
+    ; Init the registers
+    ld iy, (ix + pixels)
+
+    ; If the first pixel doesn't get drawn (the last run of pixels ended partway through skipping), go straight to skipping
+    bit 7, (ix + xError + 2)
+    jr nz, skip_pixel
+
+fill_pixels:
+    ; Write x back to local variables
+    ld (ix + varX), de
+    ; Register allocation
+    ; HL: xError
+    ; E: pixel
+    ; BC: width
+    ; IY: screenPointer
+    ; Get the pixel value
+    ld e, (iy)
+    ; Init the registers
+    push iy
+    ld hl, (ix + xError)
+    ld bc, (ix + width)
+    ld iy, (ix + screenPointer)
+    ; Clear the carry flag
+    or a, a
+fill_pixel_loop:
+    ; Write pixels while xError >= 0
+    ld (iy), e
+    ; Increment screenPointer
+    inc iy
+    ; Update xError
+    sbc hl, bc
+    ; If no carry (xError did not wrap around from being positive to negative),
+    ; jump to the beginning of the loop
+    jr nc, fill_pixel_loop
+    ; Update screenPointer
+    ld (ix + screenPointer), iy
+    ; Register allocation
+    ; HL: xError
+    ; DE: x
+    ; BC: renderWidth
+    ; IY: pixels
+    ; Init the registers
+    ld de, (ix + varX)
+    pop iy
+skip_pixel:
+    ld bc, (ix + renderWidth)
+skip_pixel_loop:
+    ; While xError < 0, update x, pixels and xError
+    inc iy
+    dec de
+    ; Add renderWidth to xError
+    add hl, bc
+    ; If carry (xError wrapped around from being negative to positive), draw the next pixel
+    jr c, next_pixel
+    ; Otherwise, keep skipping pixels, as long as there are any left
+    ld a, d
+    or a, e
+    jr nz, skip_pixel_loop
+    jr the_end
+next_pixel:
+    ; Update xError
+    ld (ix + xError), hl
+    ; Check if x is 0
+    ld a, d
+    or a, e
+    ; If it's not 0, jump to the beginning
+    jr nz, fill_pixels
+the_end:
+    ; Save xError for the next run of pixels
+    ld iy, (ix + state)
+    ld (iy), hl
+return:
+    ; Return screenPointer
+    ld hl, (ix + screenPointer)
+    ld sp, ix
+    pop ix
+    ret
+width_equ_renderWidth:
+    ; Set BC to count
+    push de
+    pop bc
+
+    ; Set DE to screenPointer
+    ld de, (ix + screenPointer)
+
+    ; Set HL to pixels
+    ld hl, (ix + pixels)
+
+    ; Copy from pixels to screenPointer
+    ldir
+
+    ; Return screenPointer
+    ex de, hl
+    ld sp, ix
+    pop ix
+    ret
+
+pixels equ 6
+count equ 9
+width equ 12
+renderWidth equ 15
+screenPointer equ 18
+state equ 21
+varX equ -3
+xError equ -6
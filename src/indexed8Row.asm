@@ -2,62 +2,61 @@ assume adl=1
 section .text
 public _displayIndexed8Row
 ; Arguments (C Convention):
-; uint8_t* rowBuffer
+; uint8_t* pixels
+; unsigned int count (must be less than 65536)
 ; unsigned int width
 ; unsigned int renderWidth
 ; uint16_t* palette
 ; uint16_t* screenPointer
+; RowState* state
+; Returns:
+; hl: screenPointer after the last pixel written
 _displayIndexed8Row:
     ; Local variables:
     ; unsigned int x
+    ; int xError
     ; Init IX
     push ix
     ld ix, 0
     add ix, sp
 
     ; Make room on the stack for local variables
-    ld hl, -3
+    ld hl, -6
     add hl, sp
     ld sp, hl
 
-    ; Check that width > 0
-    ld hl, (ix + width)
-    ld bc, 0
-    xor a, a
-    adc hl, bc
+    ; Check that count > 0
+    ld de, (ix + count)
+    sbc hl, hl
+    adc hl, de
 
-    ; If width 0, return
-    jr z, the_end
+    ; If count is 0, return
+    jp z, return
 
     ; Check if width equals renderWidth
-    ld de, (ix + renderWidth)
-    sbc hl, de
-
-    ; Restore width
-    add hl, de
+    ld hl, (ix + width)
+    ld bc, (ix + renderWidth)
+    or a, a
+    sbc hl, bc
 
     ; If width equals renderWidth, jump to the code for that
     jr z, width_equ_renderWidth
 
-    ; Put varX into DE
-    ex de, hl
-
-    ; Push rowBuffer to the stack
-    ld hl, (ix + rowBuffer)
-    push hl
+    ; Load xError from state
+    ld hl, (ix + state)
+    ld hl, (hl)
+    ld (ix + xError), hl
 
-    ; Load the first pixel into A
-    or a, (hl)
-    
-    ; Put varX back into HL
-    ex de, hl
+    ; Init the registers
+    ld iy, (ix + pixels)
 
-    ; Push xError onto the stack
-    push bc
+    ; If the first pixel doesn't get drawn (the last run of pixels ended partway through skipping), go straight to skipping
+    bit 7, (ix + xError + 2)
+    jr nz, skip_pixel
 
 fill_pixels:
-    ; Write varX back to local variables
-    ld (ix + varX), hl
+    ; Write x back to local variables
+    ld (ix + varX), de
 
     ; Register allocation
     ; HL: xError
@@ -66,15 +65,19 @@ fill_pixels:
     ; IY: screenPointer
     ; Get the pixel value
     ld bc, (ix + palette)
+    or a, a
     sbc hl, hl
-    ld l, a
+    ld l, (iy)
     add hl, hl
     add hl, bc
     ld de, (hl)
     ; Init the registers
-    pop hl
+    push iy
+    ld hl, (ix + xError)
     ld bc, (ix + width)
     ld iy, (ix + screenPointer)
+    ; Clear the carry flag
+    or a, a
 fill_pixel_loop:
     ; Write pixels while xError >= 0
     ld (iy), e
@@ -86,60 +89,68 @@ fill_pixel_loop:
     ; If no carry (xError did not wrap around from being positive to negative),
     ; jump to the beginning of the loop
     jr nc, fill_pixel_loop
-move_row_buffer:
     ; Update screenPointer
     ld (ix + screenPointer), iy
     ; Register allocation
     ; HL: xError
     ; DE: x
     ; BC: renderWidth
-    ; IY: rowBuffer
+    ; IY: pixels
     ; Init the registers
     ld de, (ix + varX)
-    ld bc, (ix + renderWidth)
     pop iy
-move_row_buffer_loop:
-    ; While xError < 0, update x, rowBuffer and xError
+skip_pixel:
+    ld bc, (ix + renderWidth)
+skip_pixel_loop:
+    ; While xError < 0, update x, pixels and xError
     inc iy
     dec de
     ; Add renderWidth to xError
     add hl, bc
-    ; If no carry (xError did not wrap around from being negative to positive),
-    ; jump to the beginning of the loop
-    jr nc, move_row_buffer_loop
-check_x:
-    ; Load the next pixel into A
-    ld a, (iy)
-    ; Push rowBuffer back onto the stack
-    push iy
+    ; If carry (xError wrapped around from being negative to positive), draw the next pixel
+    jr c, next_pixel
+    ; Otherwise, keep skipping pixels, as long as there are any left
+    ld a, d
+    or a, e
+    jr nz, skip_pixel_loop
+    jr the_end
+next_pixel:
     ; Update xError
-    push hl
+    ld (ix + xError), hl
     ; Check if x is 0
-    or a, a
-    sbc hl, hl
-    adc hl, de
+    ld a, d
+    or a, e
     ; If it's not 0, jump to the beginning
     jr nz, fill_pixels
-    jr the_end
+the_end:
+    ; Save xError for the next run of pixels
+    ld iy, (ix + state)
+    ld (iy), hl
+return:
+    ; Return screenPointer
+    ld hl, (ix + screenPointer)
+    ld sp, ix
+    pop ix
+    ret
 width_equ_renderWidth:
     ; Register allocation:
-    ; HL: varX
+    ; HL: palette entry
     ; DE: screenPointer
-    ; BC: palette/0
-    ; IY: rowBuffer
+    ; BC: 2
+    ; IY: pixels
     ; Set registers
-    ld iy, (ix + rowBuffer)
+    ld iy, (ix + pixels)
     ld de, (ix + screenPointer)
+    ; Keep x in the local variable
+    ld hl, (ix + count)
+    ld (ix + varX), hl
 width_equ_renderWidth_loop:
-    ; Save varX to the stack
-    push hl
-
     ; Get the pixel value
-    ld a, (iy)
     ; Get the address of entry in the palette for that pixel
     ld bc, (ix + palette)
+    or a, a
     sbc hl, hl
-    ld l, a
+    ld l, (iy)
     add hl, hl
     add hl, bc
     ld bc, 2
@@ -148,27 +159,28 @@ width_equ_renderWidth_loop:
     ; Increment IY
     inc iy
 
-    ; Pop X from the stack
-    pop hl
-
-    ; Set BC to 1
-    inc bc
-
     ; Decrement and test X
-    sbc hl, bc
+    ld hl, (ix + varX)
+    dec hl
+    ld (ix + varX), hl
+    ld a, h
+    or a, l
 
     ; If X is not zero, jump to the beginning
     jr nz, width_equ_renderWidth_loop
-the_end:
+
+    ; Return screenPointer
+    ex de, hl
     ld sp, ix
     pop ix
     ret
 
-rowBuffer equ 6
-width equ 9
-renderWidth equ 12
-palette equ 15
-screenPointer equ 18
+pixels equ 6
+count equ 9
+width equ 12
+renderWidth equ 15
+palette equ 18
+screenPointer equ 21
+state equ 24
 varX equ -3
-
-extern _rgb888to565
\ No newline at end of file
+xError equ -6
@@ -10,36 +10,73 @@
 #include "jpeg.hpp"
 #include "common.h"
 #include "usb.h"
+#include "areaScale.hpp"
+#include "dither.hpp"
+#include "screen.hpp"
+#include "cache.hpp"
+#include "arena.hpp"
+
+extern "C" {
+    // These work the same way as the bitmap row kernels, drawing a run of count pixels from a row that's width pixels wide
+    // (scaled to renderWidth) and picking up where the last run left off.
+    // Draws pixels whose blue, green and red are in separate planes
+    uint16_t* displayPlanarRow(uint8_t* blue, uint8_t* green, uint8_t* red, unsigned int count, unsigned int width, unsigned int renderWidth,
+        uint16_t* screenPointer, RowState* state);
+    // Draws 8 bit gray pixels
+    uint16_t* displayGrayRow(uint8_t* pixels, unsigned int count, unsigned int width, unsigned int renderWidth, uint16_t* screenPointer, RowState* state);
+    // Copies 8 bit values to vram as they are (for when the LCD is in 8bpp mode)
+    uint8_t* displayIndexRow(uint8_t* pixels, unsigned int count, unsigned int width, unsigned int renderWidth, uint8_t* screenPointer, RowState* state);
+}
 
 struct jpegReadData {
     // File handle
     fat_file_t* handle;
-    // File size
-    uint32_t size;
-    // Current position in the file
-    uint32_t pos;
+    // How many bytes of the file haven't been handed to picojpeg yet
+    uint32_t bytesLeft;
     // Pointer to our current location in the buffer
     uint8_t* inputPointer;
+    // End of the half of the input buffer we're reading from (the other half is being filled in the background)
+    uint8_t* bufferEnd;
+    // Counts calls to jpegRead, so the USB driver only gets looked at every jpegPumpInterval of them
+    uint8_t pumpCount;
 };
 
+// picojpeg asks for a little under 256 bytes at a time, so this is about every 2KB of compressed data
+#define jpegPumpInterval 8
+
+// Starts reading the file from the beginning
+bool jpegRewind(jpegReadData* file) {
+    // Whatever's still coming in is going to be thrown out
+    waitForReads();
+    if (!seekFile(file->handle, 0, set)) {
+        return false;
+    }
+
+    // Initialize the buffer: the first half straight away, and the second in the background
+    if (!readFile(file->handle, inputHalfBlocks, inputBuffer) || !readFileAsync(file->handle, inputHalfBlocks, inputBuffer + inputHalfSize)) {
+        return false;
+    }
+
+    // Initialize our struct
+    file->bytesLeft = fat_GetFileSize(file->handle);
+    file->pumpCount = 0;
+    file->inputPointer = inputBuffer;
+    file->bufferEnd = inputBuffer + inputHalfSize;
+    return true;
+}
+
 bool jpegOpenFile(const char* path, const char* name, jpegReadData* file) {
     // Open the file
     file->handle = openFile(path, name, false);
     if (!file->handle) {
         return false;
     }
-
-    // Initialize the buffer
-    if (!readFile(file->handle, inputBufferSize/FAT_BLOCK_SIZE, inputBuffer)) {
+    if (!jpegRewind(file)) {
         os_PutStrFull(" !Read failed.!");
         closeFile(file->handle);
+        file->handle = nullptr;
         return false;
     }
-
-    // Initialize our struct
-    file->size = fat_GetFileSize(file->handle);
-    file->pos = 0;
-    file->inputPointer = inputBuffer;
     return true;
 }
 
@@ -54,26 +91,43 @@ unsigned char jpegRead(unsigned char* pBuf, unsigned char buf_size, unsigned cha
     // How many bytes are left to copy from the input buffer to pBuf
     uint8_t bytesRemaining = buf_size;
 
-    // Type cast probably unnecessary but I want to be safe
     // If EOF is less than buf_size away, only read to EOF.
-    if (callbackData->size - callbackData->pos < (uint32_t)buf_size) {
-        bytesRemaining = callbackData->size - callbackData->pos;
+    if (callbackData->bytesLeft < buf_size) {
+        bytesRemaining = callbackData->bytesLeft;
     }
+    callbackData->bytesLeft -= bytesRemaining;
 
     // Write how many bytes we're going to read.
     *pBytes_actually_read = bytesRemaining;
 
-    // Update our current position in the file.
-    callbackData->pos += bytesRemaining;
-
-    // While the end of the requested area is outside the input buffer, 
-    // copy what's in the input buffer and load the next chunk into the input buffer.
-    while (callbackData->inputPointer + bytesRemaining > inputBufferEnd) {
-        memcpy(pBuf, callbackData->inputPointer, inputBufferEnd - callbackData->inputPointer);
-        pBuf += inputBufferEnd - callbackData->inputPointer;
-        bytesRemaining -= inputBufferEnd - callbackData->inputPointer;
-        callbackData->inputPointer = inputBuffer;
-        if (!readFile(callbackData->handle, inputBufferSize/FAT_BLOCK_SIZE, inputBuffer)) {
+    // Give the USB driver a chance to keep the next chunk coming in
+    if (++callbackData->pumpCount == jpegPumpInterval) {
+        callbackData->pumpCount = 0;
+        pumpReads();
+    }
+
+    // Nearly every call is served from the current half in one go
+    if (bytesRemaining <= callbackData->bufferEnd - callbackData->inputPointer) {
+        memcpy(pBuf, callbackData->inputPointer, bytesRemaining);
+        callbackData->inputPointer += bytesRemaining;
+        return 0;
+    }
+
+    // While the end of the requested area is outside the current half of the input buffer,
+    // copy what's left in it, switch to the other half (once it's finished loading),
+    // and start loading the next chunk into the half we just finished with.
+    while (callbackData->inputPointer + bytesRemaining > callbackData->bufferEnd) {
+        uint8_t* finishedHalf = callbackData->bufferEnd - inputHalfSize;
+        memcpy(pBuf, callbackData->inputPointer, callbackData->bufferEnd - callbackData->inputPointer);
+        pBuf += callbackData->bufferEnd - callbackData->inputPointer;
+        bytesRemaining -= callbackData->bufferEnd - callbackData->inputPointer;
+        if (!waitForReads()) {
+            os_PutStrFull(" !Read failed.!");
+            return PJPG_STREAM_READ_ERROR;
+        }
+        callbackData->inputPointer = callbackData->bufferEnd == inputBufferEnd ? inputBuffer : callbackData->bufferEnd;
+        callbackData->bufferEnd = callbackData->inputPointer + inputHalfSize;
+        if (!readFileAsync(callbackData->handle, inputHalfBlocks, finishedHalf)) {
             os_PutStrFull(" !Read failed.!");
             return PJPG_STREAM_READ_ERROR;
         }
@@ -90,8 +144,152 @@ unsigned char jpegRead(unsigned char* pBuf, unsigned char buf_size, unsigned cha
     return 0;
 }
 
+// Whether picojpeg is decoding in reduce mode, where each 8x8 block comes out as a single pixel (its DC value, with no IDCT).
+// picojpeg keeps its state in globals, so there's only ever one image being decoded.
+static bool reduced = false;
+
+// Where the pixel at (mcuX, mcuY) in the current MCU is in picojpeg's MCU buffers
+static inline size_t jpegPixelIndex(pjpeg_image_info_t* context, unsigned int mcuX, unsigned int mcuY) {
+    if (reduced) {
+        // Each block's pixel is at the start of where the block would have been
+        return ((mcuY*context->m_MCUWidth) + mcuX)*64;
+    }
+    size_t index = (mcuY*8) + mcuX;
+    if (mcuX >= 8) {
+        index += 56;
+    }
+    if (mcuY >= 8 && context->m_scanType == PJPG_YH2V2) {
+        index += 64;
+    }
+    return index;
+}
+
+// Grabs the pixel at (mcuX, mcuY) in the current MCU as a BGR triplet
+void jpegPixel(pjpeg_image_info_t* context, unsigned int mcuX, unsigned int mcuY, uint8_t* color) {
+    size_t index = jpegPixelIndex(context, mcuX, mcuY);
+    if (context->m_scanType == PJPG_GRAYSCALE) {
+        color[0] = context->m_pMCUBufR[index];
+        color[1] = color[0];
+        color[2] = color[0];
+    } else {
+        color[0] = context->m_pMCUBufB[index];
+        color[1] = context->m_pMCUBufG[index];
+        color[2] = context->m_pMCUBufR[index];
+    }
+}
+
+// Draws row mcuY of the current MCU at screenPointer, carrying on from where state says the last MCU left off,
+// and returns where it got up to.
+// The row's pixels sit in picojpeg's MCU buffers in runs of up to 8 (one for each block the row crosses),
+// and each run is handed to the kernel for the image's colors. In 8bpp mode, page is the half of vram being drawn to.
+uint16_t* jpegDrawMCURow(pjpeg_image_info_t* context, unsigned int mcuY, uint8_t mcuWidth, unsigned int renderWidth, uint16_t* screenPointer,
+    uint8_t* page, RowState* state) {
+    uint8_t mcuX = 0;
+    while (mcuX < mcuWidth) {
+        size_t index = jpegPixelIndex(context, mcuX, mcuY);
+        // In reduce mode, every pixel is in a block of its own
+        uint8_t run = reduced ? 1 : 8 - (mcuX % 8);
+        if (run > mcuWidth - mcuX) {
+            run = mcuWidth - mcuX;
+        }
+        if (page) {
+            // Positions are still worked out as if it were 16bpp, then written to as bytes
+            uint8_t* pagePointer = displayIndexRow(context->m_pMCUBufR + index, run, context->m_width, renderWidth, page + (screenPointer - vram), state);
+            screenPointer = vram + (pagePointer - page);
+        } else if (context->m_scanType == PJPG_GRAYSCALE) {
+            screenPointer = displayGrayRow(context->m_pMCUBufR + index, run, context->m_width, renderWidth, screenPointer, state);
+        } else {
+            screenPointer = displayPlanarRow(context->m_pMCUBufB + index, context->m_pMCUBufG + index, context->m_pMCUBufR + index, run,
+                context->m_width, renderWidth, screenPointer, state);
+        }
+        mcuX += run;
+    }
+    return screenPointer;
+}
+
+// Works out which row of the accumulator ring each row of the next row of MCUs gets added to
+void jpegAreaMapRows(pjpeg_image_info_t* context, unsigned int y, unsigned int renderHeight, unsigned int bandRows, uint8_t* rowMap) {
+    for (unsigned int mcuY = 0; mcuY < context->m_MCUHeight && y + mcuY < context->m_height; mcuY++) {
+        rowMap[mcuY] = areaScreenRow(y + mcuY, context->m_height, renderHeight) % bandRows;
+    }
+}
+
+// Decodes the image and draws it with area averaging.
+// MCUs come in left to right, top to bottom, so only the screen rows covered by the current row of MCUs
+// (bandRows of them, kept as a ring) need accumulators. Each screen row is drawn once the last row of MCUs touching it is done.
+// finished gets set if the whole image was decoded (rather than a key being pressed partway through).
+bool jpegDecodeArea(pjpeg_image_info_t* context, unsigned int renderWidth, unsigned int renderHeight, uint16_t* screenPointer,
+    const uint8_t* counts, AreaAccumulator* accumulator, unsigned int bandRows, bool* finished) {
+    // Where each row of the current MCU goes in the ring
+    uint8_t rowMap[16];
+    // One row of the current MCU, as BGR triplets
+    uint8_t strip[16*3];
+    // How far along the row of screen pixels the current MCU starts (relative to the first row of the ring)
+    AreaState mcuStart;
+    // The current MCU in the row we're on
+    unsigned int currentMCU = 0;
+    unsigned int x = 0;
+    // The first row of the image in the current row of MCUs
+    unsigned int y = 0;
+    // The first screen row that hasn't been drawn yet
+    unsigned int screenRow = 0;
+    // Decode status
+    uint8_t status;
+
+    memset(accumulator, 0, bandRows*renderWidth*sizeof(AreaAccumulator));
+    areaStartRow(&mcuStart, accumulator, counts);
+    jpegAreaMapRows(context, y, renderHeight, bandRows, rowMap);
+
+    while ((status = pjpeg_decode_mcu()) != PJPG_NO_MORE_BLOCKS && !os_GetCSC()) {
+        uint8_t mcuWidth = context->m_MCUWidth;
+        unsigned int mcuHeight = context->m_MCUHeight;
+        AreaState state;
+        if (status) {
+            return false;
+        }
+        if (x + mcuWidth > context->m_width) {
+            mcuWidth = context->m_width - x;
+        }
+        if (y + mcuHeight > context->m_height) {
+            mcuHeight = context->m_height - y;
+        }
+        // Every row of the MCU starts at the same column, just in a different row of the ring
+        for (unsigned int mcuY = 0; mcuY < mcuHeight; mcuY++) {
+            for (uint8_t mcuX = 0; mcuX < mcuWidth; mcuX++) {
+                jpegPixel(context, mcuX, mcuY, strip + (mcuX*3));
+            }
+            state = mcuStart;
+            state.accumulator += rowMap[mcuY]*renderWidth;
+            accumulateRGBRow(strip, mcuWidth, &state);
+        }
+        x += mcuWidth;
+        mcuStart.accumulator = state.accumulator - rowMap[mcuHeight - 1]*renderWidth;
+        mcuStart.counts = state.counts;
+        mcuStart.remaining = state.remaining;
+
+        if (currentMCU == context->m_MCUSPerRow - 1) {
+            // Draw every screen row that's been finished off by this row of MCUs
+            y += mcuHeight;
+            while (screenRow < renderHeight && areaRowStart(screenRow + 1, context->m_height, renderHeight) <= y) {
+                unsigned int rows = areaRowStart(screenRow + 1, context->m_height, renderHeight) - areaRowStart(screenRow, context->m_height, renderHeight);
+                areaResolveRow(accumulator + (screenRow % bandRows)*renderWidth, counts, renderWidth, rows, false, screenPointer);
+                screenPointer += 320;
+                screenRow++;
+            }
+            areaStartRow(&mcuStart, accumulator, counts);
+            jpegAreaMapRows(context, y, renderHeight, bandRows, rowMap);
+            x = 0;
+            currentMCU = 0;
+        } else {
+            currentMCU++;
+        }
+    }
+    *finished = status == PJPG_NO_MORE_BLOCKS;
+    return true;
+}
+
 // Assumes that init_USB has already been callled
-bool displayJPEG(const char* path, const char* name) {
+bool displayJPEG(const char* path, const char* name, bool interactive) {
     // JPEG decompression context
     pjpeg_image_info_t context;
 
@@ -101,9 +299,14 @@ bool displayJPEG(const char* path, const char* name) {
     // Pointer to our current position in vram
     uint16_t* screenPointer = vram;
     uint16_t* rowPointer;
+    // The top left corner of the image in vram
+    uint16_t* imageTopLeft;
 
-    // Used for converting rgb888 to 565
-    ColorError err[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
+    // Where the kernels got up to in each screen row the current row of MCUs covers.
+    // When the image is being stretched, a row of an MCU can land on more than one screen row, and each of those needs its own state.
+    RowState* rowStates;
+    // How many screen rows the current row of MCUs covers
+    unsigned int bandRows;
 
     // The current MCU in the row we're on
     unsigned int currentMCU = 0;
@@ -125,7 +328,21 @@ bool displayJPEG(const char* path, const char* name) {
     float yRatio;
 
     // Decode status
-    bool status;
+    uint8_t status;
+    // Whether the whole image got decoded
+    bool finished = false;
+
+    // Whether the image is being drawn with area averaging
+    bool areaScaling;
+    // Whether the image is grayscale and being drawn in 8bpp mode
+    bool gray8;
+    // Where 8bpp images get drawn to before being shown
+    uint8_t* page = nullptr;
+
+    // If the finished frame was cached the last time the image was shown, load it instead of decoding the image again
+    if (loadCachedFrame(path, name)) {
+        return true;
+    }
 
     // This code is nowhere near done, it's just for testing to see if picojpeg will work.
     // Open the JPEG file
@@ -135,11 +352,29 @@ bool displayJPEG(const char* path, const char* name) {
     }
 
     // Init picojpeg
+    reduced = false;
     if (pjpeg_decode_init(&context, jpegRead, &callbackData, 0)) {
         jpegCloseFile(&callbackData);
         return false;
     };
 
+    // If the image is getting shrunk to an 8th of its size or less, almost every pixel a full decode produces gets thrown away.
+    // Reduce mode only decodes one pixel per 8x8 block, which comes out the same once it's been scaled down the rest of the way.
+    // The header has already been read by now, so start again from the beginning of the file in reduce mode.
+    if (context.m_width >= 320*8 || context.m_height >= 240*8) {
+        if (!jpegRewind(&callbackData) || pjpeg_decode_init(&context, jpegRead, &callbackData, 1)) {
+            jpegCloseFile(&callbackData);
+            return false;
+        }
+        reduced = true;
+        // From here on, everything works on the reduced image.
+        // picojpeg doesn't look at these again once it's been initialized, so they can be changed to match.
+        context.m_width = (context.m_width + 7)/8;
+        context.m_height = (context.m_height + 7)/8;
+        context.m_MCUWidth /= 8;
+        context.m_MCUHeight /= 8;
+    }
+
     // Figure out how we need to scale and reposition the image
     if (context.m_width == 320 && context.m_height == 240) {
         renderWidth = 320;
@@ -165,17 +400,80 @@ bool displayJPEG(const char* path, const char* name) {
     }
 
     rowPointer = screenPointer;
+    imageTopLeft = screenPointer;
+
+    // Area averaging only makes sense when the image is being shrunk
+    areaScaling = settings.scaling == areaAverage && context.m_width > renderWidth && context.m_height > renderHeight;
+    gray8 = settings.paletteOutput && context.m_scanType == PJPG_GRAYSCALE && !areaScaling;
+    if (drawOffScreen && !gray8) {
+        // Only 8bpp frames can be drawn without touching the one on screen, so leave this one for later
+        jpegCloseFile(&callbackData);
+        return true;
+    }
+    ditherStart();
+
+    // Enough rows to cover every screen row a single row of MCUs can touch
+    bandRows = (static_cast<uint32_t>(context.m_MCUHeight)*renderHeight)/context.m_height + 2;
+
+    if (areaScaling) {
+        uint8_t* counts = static_cast<uint8_t*>(arenaAlloc(&imageArena, renderWidth + 1));
+        AreaAccumulator* accumulator = static_cast<AreaAccumulator*>(arenaAlloc(&imageArena, bandRows*renderWidth*sizeof(AreaAccumulator)));
+        if (counts && accumulator && areaCountColumns(context.m_width, renderWidth, counts)) {
+            // Clear out screen before writing the final image
+            use16bppMode(false);
+            memset(vram, 0, (320*240)*sizeof(uint16_t));
+            status = jpegDecodeArea(&context, renderWidth, renderHeight, screenPointer, counts, accumulator, bandRows, &finished);
+            drawInterrupted = status && !finished;
+            arenaReset(&imageArena);
+            ditherEnd();
+            jpegCloseFile(&callbackData);
+            if (status && finished && interactive) {
+                saveCachedFrame(path, name);
+            }
+            return status;
+        }
+        // Not enough memory (or the image is too big to average), so fall back to nearest neighbour
+        arenaReset(&imageArena);
+    }
+
+    rowStates = static_cast<RowState*>(arenaAlloc(&imageArena, bandRows*sizeof(RowState)));
+    if (!rowStates) {
+        os_PutStrFull(" !Failed to allocate the row states!");
+        ditherEnd();
+        jpegCloseFile(&callbackData);
+        return false;
+    }
+    memset(rowStates, 0, bandRows*sizeof(RowState));
 
-    // Clear out screen before writing the final image
-    memset(vram, 0, (320*240)*sizeof(uint16_t));
+    // Grayscale images can be drawn with the LCD in 8bpp mode, with a gray ramp for the palette.
+    // The positions in vram are still worked out as if it were 16bpp, then written to as bytes.
+    // The image is drawn into the half of vram that isn't on screen, then the LCD gets flipped over to it.
+    // Everything else is drawn straight to the screen, so only the borders get cleared beforehand
+    // (the image gets drawn over everything else, and anything that doesn't get drawn is blacked out at the end).
+    if (gray8) {
+        page = start8bppFrame(0);
+        setFrameGrayRamp();
+    } else {
+        use16bppMode(false);
+        clearBorders(imageTopLeft, renderWidth, renderHeight);
+    }
 
     // Decode the MCUs and draw them to the screen!
     while ((status = pjpeg_decode_mcu()) != PJPG_NO_MORE_BLOCKS && !os_GetCSC()) {
-        uint8_t color[3];
         uint8_t mcuWidth = context.m_MCUWidth;
         unsigned int mcuY = 0;
         unsigned int mcuHeight = context.m_MCUHeight;
+        // Where the next row of the MCU gets drawn, and where the last one drawn ended up
+        uint16_t* localScreenPointer = rowPointer;
+        uint16_t* rowEnd = rowPointer;
+        int rowXError = xError;
+        int localYError = yError;
+        // Which screen row of the current row of MCUs is being drawn
+        unsigned int bandRow = 0;
         if (status) {
+            arenaReset(&imageArena);
+            ditherEnd();
+            jpegCloseFile(&callbackData);
             return false;
         }
         if (x + mcuWidth > context.m_width) {
@@ -184,112 +482,69 @@ bool displayJPEG(const char* path, const char* name) {
         if (y + mcuHeight > context.m_height) {
             mcuHeight = context.m_height - y;
         }
-        // If this is the last MCU in the row, give it special treatment
-        if (currentMCU == context.m_MCUSPerRow - 1) {
-            while (mcuY < mcuHeight) {
-                while (yError >= 0) {
-                    int localXError = xError;
-                    uint8_t mcuX = 0;
-                    uint16_t* rowBuffer = rowPointer;
-                    while (mcuX < mcuWidth) {
-                        uint16_t pixel;
-                        size_t index = (mcuY*8) + mcuX;
-                        if (mcuX >= 8) {
-                            index += 56;
-                        }
-                        if (mcuY >= 8 && context.m_scanType == PJPG_YH2V2) {
-                            index += 64;
-                        }
-                        if (context.m_scanType == PJPG_GRAYSCALE) {
-                            color[0] = context.m_pMCUBufR[index];
-                            color[1] = color[0];
-                            color[2] = color[0];
-                        } else {
-                            color[0] = context.m_pMCUBufB[index];
-                            color[1] = context.m_pMCUBufG[index];
-                            color[2] = context.m_pMCUBufR[index];
-                        }
-                        pixel = rgb888to565(color, &err[mcuY]);
-                        while (localXError >= 0) {
-                            *rowBuffer = pixel;
-                            rowBuffer++;
-                            localXError -= context.m_width;
-                        }
-                        while (localXError < 0 && mcuX < mcuWidth) {
-                            mcuX++;
-                            localXError += renderWidth;
-                        }
-                    }
-                    rowPointer += 320;
-                    screenPointer += 320;
-                    yError -= context.m_height;
-                }
-                while (yError < 0 && mcuY < mcuHeight) {
-                    mcuY++;
-                    yError += renderHeight;
-                }
-            }
-            rowPointer = screenPointer;
-            for (uint8_t i = 0; i < 16; i++) {
-                err[i] = 0;
-            }
-            x = 0;
-            xError = 0;
-            currentMCU = 0;
+        // When the image is being shrunk, some MCUs fall entirely between the columns (or rows) that get drawn.
+        // Those don't need to go anywhere near the kernels, the scaling errors just get moved on past them.
+        bool columnsVisible = xError + static_cast<int>((mcuWidth - 1)*renderWidth) >= 0;
+        if (yError + static_cast<int>((mcuHeight - 1)*renderHeight) < 0) {
+            localYError += mcuHeight*renderHeight;
         } else {
-            uint16_t* localScreenPointer = rowPointer;
-            uint16_t* rowBuffer = rowPointer;
-            int localYError = yError;
-            int localXError;
             while (mcuY < mcuHeight) {
                 while (localYError >= 0) {
-                    uint8_t mcuX = 0;
-                    localXError = xError;
-                    rowBuffer = localScreenPointer;
-                    while (mcuX < mcuWidth) {
-                        uint16_t pixel;
-                        size_t index = (mcuY*8) + mcuX;
-                        if (mcuX >= 8) {
-                            index += 56;
-                        }
-                        if (mcuY >= 8 && context.m_scanType == PJPG_YH2V2) {
-                            index += 64;
-                        }
-                        if (context.m_scanType == PJPG_GRAYSCALE) {
-                            color[0] = context.m_pMCUBufR[index];
-                            color[1] = color[0];
-                            color[2] = color[0];
-                        } else {
-                            color[0] = context.m_pMCUBufB[index];
-                            color[1] = context.m_pMCUBufG[index];
-                            color[2] = context.m_pMCUBufR[index];
-                        }
-                        pixel = rgb888to565(color, &err[mcuY]);
-                        while (localXError >= 0) {
-                            *rowBuffer = pixel;
-                            rowBuffer++;
-                            localXError -= context.m_width;
-                        }
-                        while (localXError < 0 && mcuX < mcuWidth) {
-                            mcuX++;
-                            localXError += renderWidth;
-                        }
+                    if (columnsVisible) {
+                        // Every row of the MCU starts from the same column, so it starts with the same xError
+                        rowStates[bandRow].xError = xError;
+                        rowEnd = jpegDrawMCURow(&context, mcuY, mcuWidth, renderWidth, localScreenPointer, page, &rowStates[bandRow]);
+                        rowXError = rowStates[bandRow].xError;
                     }
                     localScreenPointer += 320;
                     localYError -= context.m_height;
+                    bandRow++;
                 }
                 while (localYError < 0 && mcuY < mcuHeight) {
                     mcuY++;
                     localYError += renderHeight;
                 }
             }
+        }
+        // If this is the last MCU in the row, move down past the rows it drew, and start the next row of MCUs at the left edge
+        if (currentMCU == context.m_MCUSPerRow - 1) {
+            screenPointer += localScreenPointer - rowPointer;
+            rowPointer = screenPointer;
+            yError = localYError;
+            memset(rowStates, 0, bandRow*sizeof(RowState));
+            x = 0;
+            xError = 0;
+            currentMCU = 0;
+        } else {
+            // Otherwise, the next MCU carries on from where the rows of this one ended up
+            if (!columnsVisible) {
+                xError += mcuWidth*renderWidth;
+            } else if (localScreenPointer != rowPointer) {
+                xError = rowXError;
+                rowPointer += rowEnd - (localScreenPointer - 320);
+            }
             x += mcuWidth;
-            xError = localXError;
-            rowPointer += (rowBuffer - localScreenPointer) + 320;
             currentMCU++;
         }
     }
+    finished = status == PJPG_NO_MORE_BLOCKS;
+    drawInterrupted = !finished;
+    if (gray8) {
+        finish8bppFrame(page);
+    } else {
+        // Black out any rows that didn't get finished (because a key was pressed)
+        while (screenPointer < imageTopLeft + (renderHeight*320)) {
+            memset(screenPointer, 0, renderWidth*sizeof(uint16_t));
+            screenPointer += 320;
+        }
+    }
+    arenaReset(&imageArena);
+    ditherEnd();
     jpegCloseFile(&callbackData);
+    // Save the finished frame, so the image comes up straight away next time
+    if (finished && interactive) {
+        saveCachedFrame(path, name);
+    }
 
     return true;
 }
\ No newline at end of file
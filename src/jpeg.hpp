@@ -1 +1 @@
-bool displayJPEG(const char* path, const char* name);
\ No newline at end of file
+bool displayJPEG(const char* path, const char* name, bool interactive);
\ No newline at end of file
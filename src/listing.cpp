@@ -0,0 +1,173 @@
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cstdint>
+#include "listing.hpp"
+#include "arena.hpp"
+#include "usb.h"
+
+static directoryListing* listingStack[listingStackDepth];
+static unsigned int listingDepth = 0;
+
+// Frees the listing on top of the stack (along with everything allocated after it)
+static void popListing() {
+    directoryListing* listing = listingStack[--listingDepth];
+    if (!listing->complete) {
+        closeDir(&listing->dir);
+    }
+    arenaRelease(&directoryArena, listing->arenaMark);
+}
+
+// Whether path is inside the directory at parent (or is parent)
+static bool insideDirectory(const char* parent, const char* path) {
+    size_t length = strlen(parent);
+    return strncmp(parent, path, length) == 0 && (parent[length - 1] == '/' || path[length] == '/' || path[length] == 0);
+}
+
+// Puts a name into 8.3 form
+static void packName(char* key, const char* name) {
+    const char* dot = strrchr(name, '.');
+    // "." and ".." don't have extensions
+    if (dot == name || (dot == name + 1 && name[0] == '.')) {
+        dot = nullptr;
+    }
+    memset(key, ' ', 11);
+    for (unsigned int i = 0; i < 8 && name[i] && name + i != dot; i++) {
+        key[i] = toupper(name[i]);
+    }
+    if (dot) {
+        for (unsigned int i = 0; i < 3 && dot[i + 1]; i++) {
+            key[8 + i] = toupper(dot[i + 1]);
+        }
+    }
+}
+
+static void unpackName(char* name, const char* key) {
+    unsigned int length = 0;
+    for (unsigned int i = 0; i < 8 && key[i] != ' '; i++) {
+        name[length++] = key[i];
+    }
+    if (key[8] != ' ') {
+        name[length++] = '.';
+        for (unsigned int i = 8; i < 11 && key[i] != ' '; i++) {
+            name[length++] = key[i];
+        }
+    }
+    name[length] = 0;
+}
+
+// Directories come first, then everything is in order of name
+static int packedEntryCompare(const void* arg1, const void* arg2) {
+    const packedEntry* entry1 = static_cast<const packedEntry*>(arg1);
+    const packedEntry* entry2 = static_cast<const packedEntry*>(arg2);
+    if ((entry1->options & dir) != (entry2->options & dir)) {
+        return (entry1->options & dir) ? -1 : 1;
+    }
+    return memcmp(entry1->key, entry2->key, 11);
+}
+
+// Sorts the listing, and works out where the entry at position ended up
+static void sortListing(directoryListing* listing, unsigned int* position) {
+    packedEntry selected;
+    bool tracking = *position < listing->count;
+    if (tracking) {
+        selected = listing->entries[*position];
+    }
+    qsort(listing->entries, listing->count, sizeof(packedEntry), packedEntryCompare);
+    // No two entries in a directory have the same name, so the selected one can be found again by its key
+    for (unsigned int i = 0; tracking && i < listing->count; i++) {
+        if (memcmp(listing->entries[i].key, selected.key, 11) == 0) {
+            *position = i;
+            tracking = false;
+        }
+    }
+}
+
+directoryListing* openListing(const char* path) {
+    while (listingDepth && !insideDirectory(listingStack[listingDepth - 1]->path, path)) {
+        popListing();
+    }
+    if (listingDepth && strcmp(listingStack[listingDepth - 1]->path, path) == 0) {
+        return listingStack[listingDepth - 1];
+    }
+    if (listingDepth == listingStackDepth) {
+        closeListings();
+    }
+    size_t mark = arenaMark(&directoryArena);
+    directoryListing* listing = static_cast<directoryListing*>(arenaAlloc(&directoryArena, sizeof(directoryListing)));
+    if (!listing && listingDepth) {
+        // Make room by forgetting the directories above this one
+        closeListings();
+        mark = arenaMark(&directoryArena);
+        listing = static_cast<directoryListing*>(arenaAlloc(&directoryArena, sizeof(directoryListing)));
+    }
+    if (!listing) {
+        return nullptr;
+    }
+    memset(listing, 0, sizeof(directoryListing));
+    strncpy(listing->path, path, 255);
+    listing->arenaMark = mark;
+    if (!openDir(&listing->dir, path)) {
+        arenaRelease(&directoryArena, mark);
+        return nullptr;
+    }
+    listingStack[listingDepth++] = listing;
+    return listing;
+}
+
+bool scanListing(directoryListing* listing, unsigned int entries, unsigned int* position) {
+    fat_dir_entry_t dirEntry;
+    bool wasComplete = listing->complete;
+    while (!listing->complete && entries) {
+        entries--;
+        if (fat_ReadDir(&listing->dir, &dirEntry) != FAT_SUCCESS || !dirEntry.name[0]) {
+            listing->complete = true;
+            break;
+        }
+        // Hidden entries (like the image cache) are left out
+        if (dirEntry.attrib & FAT_HIDDEN) {
+            continue;
+        }
+        size_t length = strlen(dirEntry.name);
+        uint8_t options = dirEntry.attrib & dir;
+        if (length >= 4 && strcmp(dirEntry.name + length - 4, ".BMP") == 0) {
+            options |= bitmap;
+        } else if (length >= 4 && strcmp(dirEntry.name + length - 4, ".JPG") == 0) {
+            options |= jpeg;
+        } else if (!options) {
+            continue;
+        }
+        packedEntry* entry = static_cast<packedEntry*>(arenaAlloc(&directoryArena, sizeof(packedEntry)));
+        if (!listing->count) {
+            listing->entries = entry;
+        }
+        // The entries have to stay in one piece (which they always should, since this listing is on top of the arena)
+        if (!entry || entry != listing->entries + listing->count) {
+            // Out of room, so anything past this doesn't get listed
+            listing->complete = true;
+            listing->truncated = true;
+            break;
+        }
+        packName(entry->key, dirEntry.name);
+        entry->options = options;
+        listing->count++;
+    }
+    if (listing->complete && !wasComplete) {
+        closeDir(&listing->dir);
+        sortListing(listing, position);
+    }
+    return listing->complete;
+}
+
+void getListingEntry(directoryListing* listing, unsigned int position, fileEntry* entry) {
+    packedEntry* packed = &listing->entries[position];
+    unpackName(entry->name, packed->key);
+    entry->options = packed->options;
+}
+
+void closeListings() {
+    while (listingDepth) {
+        popListing();
+    }
+    arenaReset(&directoryArena);
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <fatdrvce.h>
+
+enum fileEntryOptions {
+    bitmap = 1 << 0,
+    jpeg = 1 << 1,
+    dir = FAT_DIR
+};
+
+struct fileEntry {
+    char name[13];
+    uint8_t options;
+};
+
+// Listings are kept for the current directory and the ones above it, so going back up doesn't mean scanning them again.
+// They all come out of the directory arena, stacked in the same order, so leaving a directory frees its listing in one go.
+#define listingStackDepth 8
+
+struct packedEntry {
+    // The name in 8.3 form (upper case, padded with spaces and without the dot, the way it's stored on the drive).
+    // Names in this form sort the way the file browser lists them, so it doubles as the sort key.
+    char key[11];
+    uint8_t options;
+};
+
+// Entries get packed one after another at the top of the directory arena as the directory is scanned.
+// Only the listing on top of the stack is ever scanned, so its entries can keep growing in place without being copied.
+// Once the directory has been scanned, the entries are sorted where they are.
+struct directoryListing {
+    char path[256];
+    // Left open until the whole directory has been scanned
+    fat_dir_t dir;
+    packedEntry* entries;
+    unsigned int count;
+    bool complete;
+    // Whether the directory arena filled up before the whole directory could be listed
+    bool truncated;
+    // Where the file browser was in the listing, for when it comes back to it
+    unsigned int selected;
+    unsigned int offset;
+    // Where the listing starts in the directory arena
+    size_t arenaMark;
+};
+
+// Gets the listing for a directory, either one that's already cached, or a new one that still needs to be scanned.
+// Any listings that aren't for the directory or the ones above it get freed.
+directoryListing* openListing(const char* path);
+// Scans up to entries more entries from the directory. Once the last one has been read, the listing gets sorted,
+// and the entry at position is tracked to its new position. Returns whether the listing is complete.
+bool scanListing(directoryListing* listing, unsigned int entries, unsigned int* position);
+void getListingEntry(directoryListing* listing, unsigned int position, fileEntry* entry);
+void closeListings();
@@ -1,7 +1,7 @@
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
-#include <cctype>
+#include <ctime>
 #include <graphx.h>
 #include <ti/screen.h>
 #include <ti/getcsc.h>
@@ -9,6 +9,10 @@
 #include "bitmap.hpp"
 #include "jpeg.hpp"
 #include "font.hpp"
+#include "screen.hpp"
+#include "thumbnail.hpp"
+#include "listing.hpp"
+#include "arena.hpp"
 #include "common.h"
 #include "usb.h"
 
@@ -17,26 +21,76 @@ extern "C" {
     int32_t abs_long(int32_t x);
 }
 
-enum fileEntryOptions {
-    bitmap = 1 << 0,
-    jpeg = 1 << 1,
-    dir = FAT_DIR
+viewerSettings settings = {nearestNeighbour, horizontalDither, false, true, 1, smallBuffer};
+
+// The names shown for each scaling mode in the settings menu
+const char* scalingModeNames[] = {
+    "Nearest neighbour",
+    "Area average"
+};
+
+// The names shown for each dither mode in the settings menu
+const char* ditherModeNames[] = {
+    "Horizontal",
+    "Floyd-Steinberg",
+    "Ordered (4x4 Bayer)"
+};
+
+// The names shown for settings that are either on or off
+const char* onOffNames[] = {
+    "Off",
+    "On"
+};
+
+// How long the slideshow shows each image for, in seconds
+const unsigned int slideshowIntervals[] = {3, 5, 10, 30};
+
+// The names shown for each slideshow interval in the settings menu
+const char* slideshowIntervalNames[] = {
+    "3 seconds",
+    "5 seconds",
+    "10 seconds",
+    "30 seconds"
+};
+
+// The names shown for each input buffer size in the settings menu
+const char* bufferSizeNames[] = {
+    "16KB",
+    "32KB"
 };
 
-struct fileEntry {
-    char name[13];
-    uint8_t options;
+// An entry in the settings menu
+struct settingOption {
+    const char* name;
+    uint8_t* value;
+    // How many different values the setting can have
+    uint8_t count;
+    const char** valueNames;
 };
 
+settingOption settingOptions[] = {
+    {"Scaling:", &settings.scaling, 2, scalingModeNames},
+    {"Dithering:", &settings.dither, 3, ditherModeNames},
+    {"Progressive bitmaps:", &settings.progressive, 2, onOffNames},
+    {"8bpp palette mode:", &settings.paletteOutput, 2, onOffNames},
+    {"Slideshow interval:", &settings.slideshowInterval, 4, slideshowIntervalNames},
+    {"Read buffer:", &settings.bufferSize, 2, bufferSizeNames}
+};
+
+#define numberOfSettings (sizeof(settingOptions)/sizeof(settingOption))
+
 void gfxStart() {
+    // Images drawn in 8bpp mode leave the LCD pointed at the second half of vram
+    use16bppMode(false);
     gfx_Begin();
     gfx_SetDrawBuffer();
     gfx_SetTextTransparentColor(127);
     memcpy(gfx_palette, global_palette, sizeof(uint16_t)*256);
+    setThumbnailPalette();
     gfx_SetTransparentColor(1);
 }
 
-void drawFileSelection(fileEntry file, int row, bool selected) {
+void drawFileSelection(const char* path, fileEntry file, int row, bool selected) {
     if (selected) {
         gfx_SetColor(255);
         gfx_FillRectangle_NoClip(0, (40*row)+40, 320, 40);
@@ -51,76 +105,295 @@ void drawFileSelection(fileEntry file, int row, bool selected) {
     if (file.options & dir) {
         gfx_TransparentSprite_NoClip(directory_closed, 4, (40*row)+44);
     } else {
-        gfx_TransparentSprite_NoClip(image_old_jpeg, 4, (40*row)+44);
+        gfx_sprite_t* thumbnail = findThumbnail(path, file.name);
+        if (thumbnail) {
+            gfx_Sprite_NoClip(thumbnail, 4, (40*row)+44+((32 - thumbnailHeight)/2));
+        } else {
+            gfx_TransparentSprite_NoClip(image_old_jpeg, 4, (40*row)+44);
+        }
     }
     gfx_PrintStringXY(file.name, 40, (40*row)+44);
 }
 
-int fileEntryCompare(const void* arg1, const void* arg2) {
-    const char* name1 = ((fileEntry*)arg1)->name;
-    const char* name2 = ((fileEntry*)arg2)->name;
-    if ((((fileEntry*)arg1)->options & dir) != (((fileEntry*)arg2)->options & dir)) {
-        if (((fileEntry*)arg1)->options & dir) {
+void drawListingSelection(directoryListing* listing, unsigned int position, int row, bool selected) {
+    fileEntry entry;
+    getListingEntry(listing, position, &entry);
+    drawFileSelection(listing->path, entry, row, selected);
+}
+
+// Makes the input buffer the size the settings ask for, and gives the image arena whatever heap is left after it (see arena.hpp).
+// The image arena is empty in between images, so nothing in it is lost by setting it up again.
+// If the new size doesn't fit, it goes back to previous, and failing that, the smallest size.
+// Returns false if there wasn't enough memory for any input buffer at all.
+bool moveInputBuffer(uint8_t previous) {
+    arenaFree(&imageArena);
+    bool good = placeInputBuffer(settings.bufferSize, heapReserve + imageArenaMinSize);
+    if (!good && settings.bufferSize != previous) {
+        settings.bufferSize = previous;
+        good = placeInputBuffer(previous, heapReserve + imageArenaMinSize);
+    }
+    if (!good) {
+        // Leaving the image arena short is better than not being able to read anything
+        settings.bufferSize = smallBuffer;
+        good = placeInputBuffer(smallBuffer, heapReserve);
+    }
+    size_t heap = heapLargestBlock();
+    heap = (heap > heapReserve) ? heap - heapReserve : 0;
+    arenaInit(&imageArena, (heap < imageArenaSize) ? heap : imageArenaSize);
+    return good;
+}
+
+// Shows a message on a blank screen and waits for a key
+void showMessage(const char* message) {
+    gfx_SetTextScale(1, 1);
+    gfx_SetTextFGColor(255);
+    gfx_SetTextBGColor(0);
+    gfx_FillScreen(0);
+    printStringCentered(message, 112);
+    printStringCentered("Press any key to continue.", 124);
+    gfx_SwapDraw();
+    while (!os_GetCSC());
+}
+
+// Lets the user change how images are displayed.
+// Returns false if the input buffer couldn't be set up again afterwards (so nothing can be read any more).
+bool settingsMenu() {
+    unsigned int selected = 0;
+    uint8_t oldBufferSize = settings.bufferSize;
+    bool quit = false;
+    while (!quit) {
+        gfx_SetTextScale(2, 2);
+        gfx_SetTextFGColor(255);
+        gfx_SetTextBGColor(0);
+        gfx_FillScreen(0);
+        printStringCentered("Settings", 4);
+        gfx_SetTextScale(1, 1);
+        for (unsigned int i = 0; i < numberOfSettings; i++) {
+            if (i == selected) {
+                gfx_SetColor(255);
+                gfx_FillRectangle_NoClip(0, (25*i)+36, 320, 24);
+                gfx_SetTextFGColor(0);
+                gfx_SetTextBGColor(255);
+            } else {
+                gfx_SetTextFGColor(255);
+                gfx_SetTextBGColor(0);
+            }
+            printStringCentered(settingOptions[i].name, (25*i)+38);
+            printStringCentered(settingOptions[i].valueNames[*settingOptions[i].value], (25*i)+49);
+        }
+        gfx_SetTextFGColor(255);
+        gfx_SetTextBGColor(0);
+        printStringCentered("Press up/down to pick a setting,", 188);
+        printStringCentered("left/right to change it,", 200);
+        printStringCentered("or mode to go back.", 212);
+        gfx_SwapDraw();
+        bool quit1 = false;
+        while (!quit1) {
+            switch (os_GetCSC()) {
+                case sk_Up:
+                    if (selected > 0) {
+                        selected--;
+                        quit1 = true;
+                    }
+                    break;
+                case sk_Down:
+                    if (selected + 1 < numberOfSettings) {
+                        selected++;
+                        quit1 = true;
+                    }
+                    break;
+                case sk_Left:
+                    if (*settingOptions[selected].value == 0) {
+                        *settingOptions[selected].value = settingOptions[selected].count;
+                    }
+                    (*settingOptions[selected].value)--;
+                    quit1 = true;
+                    break;
+                case sk_Right:
+                    (*settingOptions[selected].value)++;
+                    if (*settingOptions[selected].value >= settingOptions[selected].count) {
+                        *settingOptions[selected].value = 0;
+                    }
+                    quit1 = true;
+                    break;
+                case sk_Mode:
+                case sk_Clear:
+                    quit = true;
+                    quit1 = true;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    uint8_t wantedBufferSize = settings.bufferSize;
+    bool good = moveInputBuffer(oldBufferSize);
+    if (!good) {
+        showMessage("Not enough memory for the read buffer.");
+    } else if (settings.bufferSize != wantedBufferSize) {
+        showMessage("Not enough memory for a bigger read buffer.");
+    }
+    gfx_SetTextScale(2, 2);
+    return good;
+}
+
+// Draws whichever kind of image the entry is
+bool drawImage(const char* path, fileEntry* entry, bool interactive) {
+    drawInterrupted = false;
+    if (entry->options & bitmap) {
+        return displayBitmap(path, entry->name, interactive);
+    } else if (entry->options & jpeg) {
+        return displayJPEG(path, entry->name, interactive);
+    }
+    return false;
+}
+
+// Displays whichever kind of image the entry is, and waits for a key to be pressed before going back.
+// The first time an image is displayed, a thumbnail of it gets cached for the file browser.
+bool displayImage(const char* path, fileEntry* entry) {
+    startThumbnail(path, entry->name);
+    bool status = drawImage(path, entry, true);
+    // Bitmaps wait for the key themselves (and take the thumbnail before then), so they can be zoomed into in the meantime
+    if (!status || !(entry->options & bitmap)) {
+        if (status && !drawInterrupted) {
+            captureThumbnail();
+        }
+        while (!os_GetCSC());
+    }
+    if (status) {
+        finishThumbnail();
+    }
+    return status;
+}
+
+#ifdef BENCHMARK
+// Displays the image once with each scaling mode and prints how long each one took
+bool benchmarkImage(const char* path, fileEntry* entry) {
+    uint8_t oldScaling = settings.scaling;
+    unsigned long times[2];
+    char buffer[64];
+    bool status = true;
+    for (uint8_t mode = nearestNeighbour; mode <= areaAverage; mode++) {
+        settings.scaling = mode;
+        clock_t start = clock();
+        status = drawImage(path, entry, false) && status;
+        times[mode] = ((clock() - start)*1000)/CLOCKS_PER_SEC;
+    }
+    settings.scaling = oldScaling;
+    // The high water mark shows how close the image came to running out of memory
+    sprintf(buffer, "NN:%lums AA:%lums Mem:%u/%u", times[nearestNeighbour], times[areaAverage], imageArena.highWater, imageArena.size);
+    os_PutStrFull(buffer);
+    while (!os_GetCSC());
+    return status;
+}
+#endif
+
+// Shows every image in the list, starting from first and wrapping around, each for the slideshow interval, until a key is pressed.
+// While an 8bpp image is on screen, the next image is drawn into the other half of vram (if it can be drawn in 8bpp mode too),
+// so it can be flipped to the moment the interval is up. Anything else gets drawn once the interval is up.
+// Returns how many images took longer to draw than the interval, or -1 if there weren't any images to show.
+int slideshow(directoryListing* listing, unsigned int first) {
+    clock_t interval = slideshowIntervals[settings.slideshowInterval]*CLOCKS_PER_SEC;
+    clock_t shownAt = 0;
+    unsigned int current = first;
+    unsigned int late = 0;
+    bool started = false;
+    fileEntry entry;
+    if (!listing->count) {
+        return -1;
+    }
+    while (true) {
+        // Find the next image
+        unsigned int i = 0;
+        getListingEntry(listing, current, &entry);
+        while (i < listing->count && (entry.options & dir)) {
+            current = (current + 1) % listing->count;
+            getListingEntry(listing, current, &entry);
+            i++;
+        }
+        if (i >= listing->count) {
             return -1;
+        }
+        clock_t start = clock();
+        preparedPage = nullptr;
+        if (started && showing8bppFrame()) {
+            drawOffScreen = true;
+            if (!drawImage(listing->path, &entry, false)) {
+                // Anything that went wrong shows up when it gets drawn again on screen
+                preparedPage = nullptr;
+            }
+            drawOffScreen = false;
+            if (drawInterrupted) {
+                // The key that stopped it ends the slideshow, and the half drawn page never gets shown
+                preparedPage = nullptr;
+                return late;
+            }
+        }
+        if (started) {
+            // Only count the time spent drawing off screen if it got a frame ready.
+            // Anything that couldn't be (like a 16bpp image) gets timed below, when it's drawn for real.
+            if (preparedPage && clock() - start > interval) {
+                late++;
+            }
+            while (clock() - shownAt < interval) {
+                if (os_GetCSC()) {
+                    return late;
+                }
+            }
+        }
+        if (preparedPage) {
+            show8bppFrame(preparedPage);
         } else {
-            return 1;
+            start = clock();
+            drawImage(listing->path, &entry, false);
+            if (drawInterrupted) {
+                return late;
+            }
+            if (clock() - start > interval) {
+                late++;
+            }
         }
+        shownAt = clock();
+        started = true;
+        if (os_GetCSC()) {
+            return late;
+        }
+        current = (current + 1) % listing->count;
     }
-    for (unsigned int i = 0; name1[i] && name2[i]; i++) {
-        if (toupper(name1[i]) != toupper(name2[i])) {
-            return toupper(name1[i]) - toupper(name2[i]);
+}
+
+// Scans a bit more of the listing, keeping the same entry selected if it gets sorted.
+// Returns whether the list on screen needs to be redrawn (because entries showed up on screen, or the listing got sorted).
+bool scanListingMore(directoryListing* listing, unsigned int* selectedFile, unsigned int* offset) {
+    unsigned int before = listing->count;
+    unsigned int position = *selectedFile + *offset;
+    if (scanListing(listing, 16, &position)) {
+        if (position < *offset || position >= *offset + 5) {
+            *offset = (position + 5 > listing->count) ? ((listing->count > 5) ? listing->count - 5 : 0) : position;
         }
+        *selectedFile = position - *offset;
+        return true;
     }
-    return strlen(name1) - strlen(name2);
+    return before < *offset + 5 && listing->count > before;
 }
 
 void fileSelectMenu() {
     gfx_SetTextScale(2, 2);
     char currentDirPath[256] = "/";
-    unsigned int selectedFile = 0;
     bool quit = false;
-    unsigned int offset = 0;
     while (!quit) {
-        fat_dir_t* currentDir = openDir(currentDirPath);
-        if (!currentDir) {
+        // Listings are cached, so going back to a directory picks up where the browser left off in it
+        directoryListing* listing = openListing(currentDirPath);
+        if (!listing) {
             return;
         }
-        fat_dir_entry_t currentDirEntry;
-        fileEntry* entries = static_cast<fileEntry*>(malloc(sizeof(fileEntry)));
-        unsigned int numberOfEntries = 0;
-        size_t bufferSize = 1;
-        fat_ReadDir(currentDir, &currentDirEntry);
-        while (currentDirEntry.name[0]) {
-            if ((currentDirEntry.attrib & FAT_DIR) || 
-                (strcmp(currentDirEntry.name + (strlen(currentDirEntry.name)-4), ".BMP") == 0) || 
-                (strcmp(currentDirEntry.name + (strlen(currentDirEntry.name)-4), ".JPG") == 0)) {
-                if (numberOfEntries >= bufferSize) {
-                    bufferSize *= 2;
-                    entries = static_cast<fileEntry*>(realloc(entries, sizeof(fileEntry)*(bufferSize)));
-                    if (!entries) {
-                        return;
-                    }
-                }
-                if (strcmp(currentDirEntry.name + (strlen(currentDirEntry.name)-4), ".BMP") == 0) {
-                    entries[numberOfEntries].options = bitmap;
-                }
-                if (strcmp(currentDirEntry.name + (strlen(currentDirEntry.name)-4), ".JPG") == 0) {
-                    entries[numberOfEntries].options = jpeg;
-                }
-                // Safe because it's not possible for a FAT32 file to have a name longer than 12 characters (8.3 filenames)
-                strcpy(entries[numberOfEntries].name, currentDirEntry.name);
-                entries[numberOfEntries].options |= currentDirEntry.attrib & dir;
-                numberOfEntries++;
-            }
-            fat_ReadDir(currentDir, &currentDirEntry);
-        }
-        entries = static_cast<fileEntry*>(realloc(entries, sizeof(fileEntry)*(numberOfEntries)));
-        if (!entries) {
-            return;
-        }
-        qsort(entries, numberOfEntries, sizeof(fileEntry), fileEntryCompare);
-        if (selectedFile >= numberOfEntries) {
-            selectedFile = numberOfEntries - 1;
+        unsigned int selectedFile = listing->selected;
+        unsigned int offset = listing->offset;
+        fileEntry selection;
+        // Only the first screenful needs to be scanned before the list can be shown.
+        // The rest gets scanned while waiting for keys.
+        while (!listing->complete && listing->count < offset + 5) {
+            scanListingMore(listing, &selectedFile, &offset);
         }
         bool quit1 = false;
         while (!quit1) {
@@ -128,22 +401,42 @@ void fileSelectMenu() {
             gfx_SetTextBGColor(0);
             gfx_FillScreen(0);
             printStringCentered("Please select an", 4);
-            printStringCentered("image to open", 20);
-            for (unsigned int i = 0; i + offset < numberOfEntries && i < 5; i++) {
-                drawFileSelection(entries[i + offset], i, i == selectedFile);
+            if (listing->truncated) {
+                // Let the user know there are files that didn't make it into the list
+                char message[24];
+                sprintf(message, "(only %u listed)", listing->count);
+                printStringCentered(message, 20);
+            } else {
+                printStringCentered("image to open", 20);
+            }
+            for (unsigned int i = 0; i + offset < listing->count && i < 5; i++) {
+                drawListingSelection(listing, i + offset, i, i == selectedFile);
             }
             gfx_SwapDraw();
             bool quit2 = false;
             while (!quit2) {
-                switch(os_GetCSC()) {
+                uint8_t key = os_GetCSC();
+                if (!key) {
+                    if (!listing->complete && scanListingMore(listing, &selectedFile, &offset)) {
+                        quit2 = true;
+                    }
+                    continue;
+                }
+                if (selectedFile + offset < listing->count) {
+                    getListingEntry(listing, selectedFile + offset, &selection);
+                } else if (key == sk_Enter || key == sk_Yequ) {
+                    // Nothing to open
+                    continue;
+                }
+                switch (key) {
                     case sk_Enter:
-                        if (entries[selectedFile + offset].options & dir) {
-                            if (strcmp(entries[selectedFile + offset].name, ".") != 0) {
+                        if (selection.options & dir) {
+                            if (strcmp(selection.name, ".") != 0) {
                                 if (currentDirPath[strlen(currentDirPath) - 1] != '/') {
                                     strncat(currentDirPath, "/", 256);
                                     currentDirPath[255] = 0;
                                 }
-                                if (strcmp(entries[selectedFile + offset].name, "..") == 0) {
+                                if (strcmp(selection.name, "..") == 0) {
                                     char* pathPointer = currentDirPath + strlen(currentDirPath) - 1;
                                     if (*pathPointer == '/') {
                                         pathPointer--;
@@ -157,23 +450,19 @@ void fileSelectMenu() {
                                         *pathPointer = 0;
                                     }
                                 } else {
-                                    strncat(currentDirPath, entries[selectedFile + offset].name, 256);
+                                    strncat(currentDirPath, selection.name, 256);
                                     currentDirPath[255] = 0;
                                 }
                             }
-                            offset = 0;
-                            selectedFile = 0;
                             quit1 = true;
                             quit2 = true;
                         } else {
                             gfx_End();
-                            bool status;
-                            if (entries[selectedFile + offset].options & bitmap) {
-                                status = displayBitmap(currentDirPath, entries[selectedFile + offset].name);
-                            } else if (entries[selectedFile + offset].options & jpeg) {
-                                status = displayJPEG(currentDirPath, entries[selectedFile + offset].name);
-                            }
-                            while (!os_GetCSC());
+                            #ifdef BENCHMARK
+                            bool status = benchmarkImage(currentDirPath, &selection);
+                            #else
+                            bool status = displayImage(currentDirPath, &selection);
+                            #endif
                             gfxStart();
                             gfx_SetTextScale(2, 2);
                             gfx_SetTextFGColor(255);
@@ -181,7 +470,7 @@ void fileSelectMenu() {
                             gfx_FillScreen(0);
                             if (!status) {
                                 printStringCentered("Failed to open image", 4);
-                                printStringCentered(entries[selectedFile + offset].name, 23);
+                                printStringCentered(selection.name, 23);
                                 printStringCentered("Press any key to", 42);
                                 printStringCentered("continue", 61);
                                 gfx_SwapDraw();
@@ -193,9 +482,9 @@ void fileSelectMenu() {
                     case sk_Up:
                         gfx_BlitScreen();
                         if (selectedFile > 0) {
-                            drawFileSelection(entries[selectedFile + offset], selectedFile, false);
+                            drawListingSelection(listing, selectedFile + offset, selectedFile, false);
                             selectedFile--;
-                            drawFileSelection(entries[selectedFile + offset], selectedFile, true);
+                            drawListingSelection(listing, selectedFile + offset, selectedFile, true);
                         } else if (selectedFile + offset > 0) {
                             offset--;
                             quit2 = true;
@@ -204,11 +493,11 @@ void fileSelectMenu() {
                         break;
                     case sk_Down:
                         gfx_BlitScreen();
-                        if (selectedFile + offset + 1 < numberOfEntries) {
+                        if (selectedFile + offset + 1 < listing->count) {
                             if (selectedFile < 4) {
-                                drawFileSelection(entries[selectedFile + offset], selectedFile, false);
+                                drawListingSelection(listing, selectedFile + offset, selectedFile, false);
                                 selectedFile++;
-                                drawFileSelection(entries[selectedFile + offset], selectedFile, true);
+                                drawListingSelection(listing, selectedFile + offset, selectedFile, true);
                             } else {
                                 offset++;
                                 quit2 = true;
@@ -216,6 +505,39 @@ void fileSelectMenu() {
                         }
                         gfx_SwapDraw();
                         break;
+                    case sk_Mode:
+                        if (!settingsMenu()) {
+                            quit = true;
+                            quit1 = true;
+                        }
+                        quit2 = true;
+                        break;
+                    case sk_Yequ: {
+                        gfx_End();
+                        int late = slideshow(listing, selectedFile + offset);
+                        gfxStart();
+                        gfx_SetTextScale(2, 2);
+                        gfx_SetTextFGColor(255);
+                        gfx_SetTextBGColor(0);
+                        if (late != 0) {
+                            char buffer[32];
+                            gfx_FillScreen(0);
+                            if (late < 0) {
+                                printStringCentered("No images to show", 4);
+                            } else {
+                                // Let the user know the interval was too short for some of the images
+                                printStringCentered("Drawing fell behind", 4);
+                                sprintf(buffer, "on %d image(s)", late);
+                                printStringCentered(buffer, 23);
+                            }
+                            printStringCentered("Press any key to", 42);
+                            printStringCentered("continue", 61);
+                            gfx_SwapDraw();
+                            while (!os_GetCSC());
+                        }
+                        quit2 = true;
+                        break;
+                    }
                     case sk_Clear:
                         if (strcmp(currentDirPath, "/") != 0) {
                             char* pathPointer = currentDirPath + strlen(currentDirPath) - 1;
@@ -230,8 +552,6 @@ void fileSelectMenu() {
                             } else {
                                 *pathPointer = 0;
                             }
-                            offset = 0;
-                            selectedFile = 0;
                             quit1 = true;
                             quit2 = true;
                             break;
@@ -246,9 +566,10 @@ void fileSelectMenu() {
                 }
             }
         }
-        closeDir(currentDir);
-        free(entries);
+        listing->selected = selectedFile;
+        listing->offset = offset;
     }
+    closeListings();
 }
 
 int main() {
@@ -273,7 +594,8 @@ int main() {
     printStringAndMoveDownCentered("image.");
     printStringAndMoveDownCentered("To back out of a folder, enter the folder");
     printStringAndMoveDownCentered("called \"..\".");
-    printStringAndMoveDownCentered("To exit, press \"clear\".");
+    printStringAndMoveDownCentered("To exit, press \"clear\". \"y=\": slideshow.");
+    printStringAndMoveDownCentered("Press \"mode\" for settings, \"zoom\" to zoom.");
     printStringAndMoveDownCentered("Please insert a FAT32 formatted USB drive");
     printStringAndMoveDownCentered("containing any images you want to view,");
     printStringAndMoveDownCentered("(do not remove it until you exit),");
@@ -293,7 +615,15 @@ int main() {
         gfx_End();
         return 1;
     }
-    fileSelectMenu();
+    // Set aside the memory images and directory listings get allocated from (and the input buffer),
+    // before anything else can break the heap up
+    arenaInitAppVar(&directoryArena, directoryArenaVar, directoryArenaSize);
+    if (moveInputBuffer(settings.bufferSize)) {
+        fileSelectMenu();
+    } else {
+        showMessage("Not enough memory for the read buffer.");
+    }
+    arenaFreeAppVar(&directoryArena, directoryArenaVar);
     gfx_SetDrawBuffer();
     gfx_SetTextScale(2, 2);
     gfx_SetTextFGColor(255);
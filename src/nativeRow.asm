@@ -2,64 +2,74 @@ assume adl=1
 section .text
 public _displayNativeRow
 ; Arguments (C Convention):
-; uint8_t* rowBuffer
+; uint8_t* pixels
+; unsigned int count (must be less than 65536)
 ; unsigned int width
 ; unsigned int renderWidth
 ; uint16_t* screenPointer
+; RowState* state
+; Returns:
+; hl: screenPointer after the last pixel written
 _displayNativeRow:
     ; Local variables:
     ; unsigned int x
+    ; int xError
     ; Init IX
     push ix
     ld ix, 0
     add ix, sp
 
     ; Make room on the stack for local variables
-    ld hl, -3
+    ld hl, -6
     add hl, sp
     ld sp, hl
 
-    ; Check that width > 0
-    ld hl, (ix + width)
-    ld bc, 0
-    or a, a
-    adc hl, bc
+    ; Check that count > 0
+    ld de, (ix + count)
+    sbc hl, hl
+    adc hl, de
 
-    ; If width 0, return
-    jr z, the_end
+    ; If count is 0, return
+    jr z, return
 
     ; Check if width equals renderWidth
-    ld de, (ix + renderWidth)
-    sbc hl, de
-
-    ; Restore width
-    add hl, de
+    ld hl, (ix + width)
+    ld bc, (ix + renderWidth)
+    or a, a
+    sbc hl, bc
 
     ; If width equals renderWidth, jump to the code for that
     jr z, width_equ_renderWidth
 
-    ; Push rowBuffer to the stack
-    ld de, (ix + rowBuffer)
-    push de
+    ; Load xError from state
+    ld hl, (ix + state)
+    ld hl, (hl)
+    ld (ix + xError), hl
+
+    ; Init the registers
+    ld iy, (ix + pixels)
 
-    ; Push xError to the stack
-    push bc
+    ; If the first pixel doesn't get drawn (the last run of pixels ended partway through skipping), go straight to skipping
+    bit 7, (ix + xError + 2)
+    jr nz, skip_pixel
 
 fill_pixels:
-    ; Write varX back to local variables
-    ld (ix + varX), hl
+    ; Write x back to local variables
+    ld (ix + varX), de
     ; Register allocation
     ; HL: xError
     ; DE: pixel
     ; BC: width
     ; IY: screenPointer
     ; Get the pixel value
-    ld hl, (ix - 6)
-    ld de, (hl)
+    ld de, (iy)
     ; Init the registers
-    pop hl
+    push iy
+    ld hl, (ix + xError)
     ld bc, (ix + width)
     ld iy, (ix + screenPointer)
+    ; Clear the carry flag
+    or a, a
 fill_pixel_loop:
     ; Write pixels while xError >= 0
     ld (iy), e
@@ -71,41 +81,52 @@ fill_pixel_loop:
     ; If no carry (xError did not wrap around from being positive to negative),
     ; jump to the beginning of the loop
     jr nc, fill_pixel_loop
-move_row_buffer:
     ; Update screenPointer
     ld (ix + screenPointer), iy
     ; Register allocation
     ; HL: xError
     ; DE: x
     ; BC: renderWidth
-    ; IY: rowBuffer
+    ; IY: pixels
     ; Init the registers
     ld de, (ix + varX)
-    ld bc, (ix + renderWidth)
     pop iy
-move_row_buffer_loop:
-    ; While xError < 0, update x, rowBuffer and xError
+skip_pixel:
+    ld bc, (ix + renderWidth)
+skip_pixel_loop:
+    ; While xError < 0, update x, pixels and xError
     lea iy, iy + 2
     dec de
     ; Add renderWidth to xError
     add hl, bc
-    ; If no carry (xError did not wrap around from being negative to positive),
-    ; jump to the beginning of the loop
-    jr nc, move_row_buffer_loop
-check_x:
-    ; Push rowBuffer back onto the stack
-    push iy
+    ; If carry (xError wrapped around from being negative to positive), draw the next pixel
+    jr c, next_pixel
+    ; Otherwise, keep skipping pixels, as long as there are any left
+    ld a, d
+    or a, e
+    jr nz, skip_pixel_loop
+    jr the_end
+next_pixel:
     ; Update xError
-    push hl
+    ld (ix + xError), hl
     ; Check if x is 0
-    or a, a
-    sbc hl, hl
-    adc hl, de
+    ld a, d
+    or a, e
     ; If it's not 0, jump to the beginning
     jr nz, fill_pixels
-    jr the_end
+the_end:
+    ; Save xError for the next run of pixels
+    ld iy, (ix + state)
+    ld (iy), hl
+return:
+    ; Return screenPointer
+    ld hl, (ix + screenPointer)
+    ld sp, ix
+    pop ix
+    ret
 width_equ_renderWidth:
-    ; Set BC to width*2
+    ; Set BC to count*2
+    ex de, hl
     add hl, hl
     push hl
     pop bc
@@ -113,20 +134,23 @@ width_equ_renderWidth:
     ; Set DE to screenPointer
     ld de, (ix + screenPointer)
 
-    ; Set HL to rowBuffer
-    ld hl, (ix + rowBuffer)
+    ; Set HL to pixels
+    ld hl, (ix + pixels)
 
-    ; Copy from rowBuffer to screenPointer
+    ; Copy from pixels to screenPointer
     ldir
-the_end:
+
+    ; Return screenPointer
+    ex de, hl
     ld sp, ix
     pop ix
     ret
 
-rowBuffer equ 6
-width equ 9
-renderWidth equ 12
-screenPointer equ 15
+pixels equ 6
+count equ 9
+width equ 12
+renderWidth equ 15
+screenPointer equ 18
+state equ 21
 varX equ -3
-
-extern _rgb888to565
\ No newline at end of file
+xError equ -6
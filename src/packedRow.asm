@@ -0,0 +1,234 @@
+assume adl=1
+section .text
+public _displayPackedRow
+; Arguments (C Convention):
+; uint8_t* pixels (must start on a byte boundary)
+; unsigned int count (must be less than 65536)
+; unsigned int width
+; unsigned int renderWidth
+; uint16_t* table
+; uint8_t pixelsPerByte
+; uint16_t* screenPointer
+; RowState* state
+; Returns:
+; hl: screenPointer after the last pixel written
+_displayPackedRow:
+    ; Local variables:
+    ; unsigned int x
+    ; uint8_t* rowPointer
+    ; int xError
+    ; uint8_t pixels left in the current byte
+    ; Init IX
+    push ix
+    ld ix, 0
+    add ix, sp
+
+    ; Make room on the stack for local variables
+    ld hl, -12
+    add hl, sp
+    ld sp, hl
+
+    ; Check that count > 0
+    ld de, (ix + count)
+    sbc hl, hl
+    adc hl, de
+
+    ; If count is 0, return
+    jp z, return
+
+    ; Init local variables
+    ld (ix + varX), hl
+
+    ; Check if width equals renderWidth
+    ld hl, (ix + width)
+    ld bc, (ix + renderWidth)
+    or a, a
+    sbc hl, bc
+
+    ; If width equals renderWidth, jump to the code for that
+    jp z, width_equ_renderWidth
+
+    ; Init local variables
+    ld hl, (ix + state)
+    ld hl, (hl)
+    ld (ix + xError), hl
+    ld hl, (ix + pixels)
+    ld (ix + varRow), hl
+
+    ; Register allocation
+    ; IY: pointer to the current pixel's entry in the table
+    call load_byte
+
+    ; Init the registers
+    ld hl, (ix + xError)
+
+    ; If the first pixel doesn't get drawn (the last run of pixels ended partway through skipping), go straight to skipping
+    bit 7, (ix + xError + 2)
+    jr nz, skip_pixel
+
+fill_pixels:
+    ; Write x back to local variables
+    ld (ix + varX), de
+    ; Register allocation
+    ; HL: xError
+    ; DE: pixel
+    ; BC: width
+    ; IY: screenPointer
+    ; Get the pixel value
+    ld e, (iy)
+    ld d, (iy + 1)
+    ; Init the registers
+    push iy
+    ld hl, (ix + xError)
+    ld bc, (ix + width)
+    ld iy, (ix + screenPointer)
+    ; Clear the carry flag
+    or a, a
+fill_pixel_loop:
+    ; Write pixels while xError >= 0
+    ld (iy), e
+    ld (iy + 1), d
+    ; Increment screenPointer
+    lea iy, iy + 2
+    ; Update xError
+    sbc hl, bc
+    ; If no carry (xError did not wrap around from being positive to negative),
+    ; jump to the beginning of the loop
+    jr nc, fill_pixel_loop
+    ; Update screenPointer
+    ld (ix + screenPointer), iy
+    ; Register allocation
+    ; HL: xError
+    ; DE: x
+    ; BC: renderWidth
+    ; IY: pointer to the current pixel's entry in the table
+    ; Init the registers
+    ld de, (ix + varX)
+    pop iy
+skip_pixel:
+    ld bc, (ix + renderWidth)
+skip_pixel_loop:
+    ; While xError < 0, move on to the next pixel
+    lea iy, iy + 2
+    dec (ix + varBit)
+    ; If that was the last pixel in the byte, load the next byte
+    call z, next_byte
+    dec de
+    ; Add renderWidth to xError
+    add hl, bc
+    ; If carry (xError wrapped around from being negative to positive), draw the next pixel
+    jr c, next_pixel
+    ; Otherwise, keep skipping pixels, as long as there are any left
+    ld a, d
+    or a, e
+    jr nz, skip_pixel_loop
+    jr the_end
+next_pixel:
+    ; Update xError
+    ld (ix + xError), hl
+    ; Check if x is 0
+    ld a, d
+    or a, e
+    ; If it's not 0, jump to the beginning
+    jr nz, fill_pixels
+the_end:
+    ; Save xError for the next run of pixels
+    ld iy, (ix + state)
+    ld (iy), hl
+return:
+    ; Return screenPointer
+    ld hl, (ix + screenPointer)
+    ld sp, ix
+    pop ix
+    ret
+
+width_equ_renderWidth:
+    ; Register allocation
+    ; HL: pixels left
+    ; DE: screenPointer
+    ; BC: bytes to copy
+    ; IY: pixels
+    ld de, (ix + screenPointer)
+    ld iy, (ix + pixels)
+width_equ_renderWidth_loop:
+    ; Copy a whole byte's worth of pixels, unless there's less than that left in the row
+    ld bc, 0
+    ld c, (ix + pixelsPerByte)
+    ld hl, (ix + varX)
+    or a, a
+    sbc hl, bc
+    jr nc, full_byte
+    add hl, bc
+    ld c, l
+    or a, a
+    sbc hl, hl
+full_byte:
+    ld (ix + varX), hl
+    ; Find the byte's entry in the table
+    push bc
+    ld a, (ix + pixelsPerByte)
+    add a, a
+    ld b, a
+    ld c, (iy)
+    mlt bc
+    ld hl, (ix + table)
+    add hl, bc
+    pop bc
+    ; Each pixel is 2 bytes
+    sla c
+    ldir
+    inc iy
+    ; Check if there are any pixels left
+    ld hl, (ix + varX)
+    or a, a
+    sbc hl, bc
+    ; If there are, jump to the beginning
+    jr nz, width_equ_renderWidth_loop
+
+    ; Return screenPointer
+    ex de, hl
+    ld sp, ix
+    pop ix
+    ret
+
+; Moves on to the next byte of the row
+; Output: IY = pointer to the byte's entry in the table, and the count of pixels left in the byte reset
+; Preserves BC, DE and HL
+next_byte:
+    push hl
+    ld hl, (ix + varRow)
+    inc hl
+    ld (ix + varRow), hl
+    pop hl
+; Same as next_byte, but for the byte rowPointer is already on
+load_byte:
+    push hl
+    push bc
+    ; Each entry is pixelsPerByte pixels long
+    ld bc, 0
+    ld a, (ix + pixelsPerByte)
+    add a, a
+    ld b, a
+    ld hl, (ix + varRow)
+    ld c, (hl)
+    mlt bc
+    ld iy, (ix + table)
+    add iy, bc
+    ld a, (ix + pixelsPerByte)
+    ld (ix + varBit), a
+    pop bc
+    pop hl
+    ret
+
+pixels equ 6
+count equ 9
+width equ 12
+renderWidth equ 15
+table equ 18
+pixelsPerByte equ 21
+screenPointer equ 24
+state equ 27
+varX equ -3
+varRow equ -6
+xError equ -9
+varBit equ -12
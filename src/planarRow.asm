@@ -0,0 +1,177 @@
+assume adl=1
+section .text
+public _displayPlanarRow
+; Arguments (C Convention):
+; uint8_t* blue
+; uint8_t* green
+; uint8_t* red
+; unsigned int count (must be less than 65536)
+; unsigned int width
+; unsigned int renderWidth
+; uint16_t* screenPointer
+; RowState* state
+; Returns:
+; hl: screenPointer after the last pixel written
+; Draws pixels whose channels are kept in three separate planes (like picojpeg's MCU buffers)
+_displayPlanarRow:
+    ; Local variables:
+    ; int xError
+    ; unsigned int x
+    ; uint8_t color[3]
+    ; uint8_t* pixel
+    ; int greenOffset
+    ; int redOffset
+    ; Init IX
+    push ix
+    ld ix, 0
+    add ix, sp
+
+    ; Make room on the stack for local variables
+    ld hl, -18
+    add hl, sp
+    ld sp, hl
+
+    ; Load xError from state
+    ld hl, (ix + state)
+    ld de, (hl)
+    ld (ix + xError), de
+
+    ; Push &state->err to the stack for rgb888to565
+    inc hl
+    inc hl
+    inc hl
+    push hl
+
+    ; Check that count > 0
+    ld de, (ix + count)
+    sbc hl, hl
+    adc hl, de
+
+    ; If count is 0, return
+    jp z, return
+
+    ; Work out how far the green and red planes are from the blue one,
+    ; so only one pointer has to be moved along
+    ld bc, (ix + blue)
+    ld hl, (ix + green)
+    or a, a
+    sbc hl, bc
+    ld (ix + greenOffset), hl
+    ld hl, (ix + red)
+    or a, a
+    sbc hl, bc
+    ld (ix + redOffset), hl
+
+    ; Init the registers
+    ld iy, (ix + blue)
+    ld hl, (ix + xError)
+    ld bc, (ix + renderWidth)
+
+    ; If the first pixel doesn't get drawn (the last run of pixels ended partway through skipping), go straight to skipping
+    bit 7, (ix + xError + 2)
+    jr nz, skip_pixel
+
+fill_pixels:
+    ; Write x and pixel back to local variables
+    ld (ix + varX), de
+    ld (ix + varPixel), iy
+    ; Gather the pixel out of the three planes into color, as a BGR triplet
+    ld a, (iy)
+    ld (ix + varColor), a
+    lea hl, iy + 0
+    ld bc, (ix + greenOffset)
+    add hl, bc
+    ld a, (hl)
+    ld (ix + varColor + 1), a
+    lea hl, iy + 0
+    ld bc, (ix + redOffset)
+    add hl, bc
+    ld a, (hl)
+    ld (ix + varColor + 2), a
+
+    ; Register allocation
+    ; HL: xError
+    ; DE: pixel
+    ; BC: width
+    ; IY: screenPointer
+    ; Get the pixel value
+    pea ix + varColor
+    call _rgb888to565
+    pop de
+    ; Init the registers
+    ex de, hl
+    ld hl, (ix + xError)
+    ld bc, (ix + width)
+    ld iy, (ix + screenPointer)
+    ; Clear the carry flag
+    or a, a
+fill_pixel_loop:
+    ; Write pixels while xError >= 0
+    ld (iy), e
+    ld (iy + 1), d
+    ; Increment screenPointer
+    lea iy, iy + 2
+    ; Update xError
+    sbc hl, bc
+    ; If no carry (xError did not wrap around from being positive to negative),
+    ; jump to the beginning of the loop
+    jr nc, fill_pixel_loop
+    ; Update screenPointer
+    ld (ix + screenPointer), iy
+    ; Register allocation
+    ; HL: xError
+    ; DE: x
+    ; BC: renderWidth
+    ; IY: pixel (in the blue plane)
+    ; Init the registers
+    ld de, (ix + varX)
+    ld bc, (ix + renderWidth)
+    ld iy, (ix + varPixel)
+skip_pixel:
+    ; While xError < 0, update x, pixel and xError
+    inc iy
+    dec de
+    ; Add renderWidth to xError
+    add hl, bc
+    ; If carry (xError wrapped around from being negative to positive), draw the next pixel
+    jr c, next_pixel
+    ; Otherwise, keep skipping pixels, as long as there are any left
+    ld a, d
+    or a, e
+    jr nz, skip_pixel
+    jr the_end
+next_pixel:
+    ; Update xError
+    ld (ix + xError), hl
+    ; Check if x is 0
+    ld a, d
+    or a, e
+    ; If it's not 0, jump to the beginning
+    jp nz, fill_pixels
+the_end:
+    ; Save xError for the next run of pixels
+    ld iy, (ix + state)
+    ld (iy), hl
+return:
+    ; Return screenPointer
+    ld hl, (ix + screenPointer)
+    ld sp, ix
+    pop ix
+    ret
+
+blue equ 6
+green equ 9
+red equ 12
+count equ 15
+width equ 18
+renderWidth equ 21
+screenPointer equ 24
+state equ 27
+xError equ -3
+varX equ -6
+varColor equ -9
+varPixel equ -12
+greenOffset equ -15
+redOffset equ -18
+
+extern _rgb888to565
@@ -2,53 +2,66 @@ assume adl=1
 section .text
 public _displayRGBRow
 ; Arguments (C Convention):
-; uint8_t* rowBuffer
+; uint8_t* pixels
+; unsigned int count (must be less than 65536)
 ; unsigned int width
 ; unsigned int renderWidth
 ; uint16_t* screenPointer
+; RowState* state
+; Returns:
+; hl: screenPointer after the last pixel written
 _displayRGBRow:
     ; Local variables:
     ; int xError
     ; unsigned int x
-    ; ColorError err
     ; Init IX
     push ix
     ld ix, 0
     add ix, sp
 
     ; Make room on the stack for local variables
-    ld hl, -9
+    ld hl, -6
     add hl, sp
     ld sp, hl
 
-    ; Check that width > 0
-    ld hl, (ix + width)
-    ld bc, -1
-    adc hl, bc
+    ; Load xError from state
+    ld hl, (ix + state)
+    ld de, (hl)
+    ld (ix + xError), de
 
-    ; If width 0, return
-    jr z, the_end
+    ; Push &state->err to the stack for rgb888to565
+    inc hl
+    inc hl
+    inc hl
+    push hl
 
-    ; Init local variables
-    inc bc
-    ld (ix + xError), bc
-    ld (ix + varErr), bc
+    ; Check that count > 0
+    ld de, (ix + count)
+    sbc hl, hl
+    adc hl, de
+
+    ; If count is 0, return
+    jr z, return
+
+    ; Init the registers
+    ld iy, (ix + pixels)
+    ld hl, (ix + xError)
+    ld bc, (ix + renderWidth)
 
-    ; Push &err to the stack for rgb888to565
-    pea ix + varErr
-    ; Push rowBuffer to the stack
-    ld de, (ix + rowBuffer)
-    push de
+    ; If the first pixel doesn't get drawn (the last run of pixels ended partway through skipping), go straight to skipping
+    bit 7, (ix + xError + 2)
+    jr nz, skip_pixel
 
 fill_pixels:
-    ; Write varX back to local variables
-    ld (ix + varX), hl
+    ; Write x back to local variables
+    ld (ix + varX), de
     ; Register allocation
     ; HL: xError
     ; DE: pixel
     ; BC: width
     ; IY: screenPointer
     ; Get the pixel value
+    push iy
     call _rgb888to565
     ; Init the registers
     ex de, hl
@@ -68,48 +81,56 @@ fill_pixel_loop:
     ; If no carry (xError did not wrap around from being positive to negative),
     ; jump to the beginning of the loop
     jr nc, fill_pixel_loop
-move_row_buffer:
     ; Update screenPointer
     ld (ix + screenPointer), iy
     ; Register allocation
     ; HL: xError
     ; DE: x
     ; BC: renderWidth
-    ; IY: rowBuffer
+    ; IY: pixels
     ; Init the registers
     ld de, (ix + varX)
     ld bc, (ix + renderWidth)
     pop iy
-move_row_buffer_loop:
-    ; While xError < 0, update x, rowBuffer and xError
+skip_pixel:
+    ; While xError < 0, update x, pixels and xError
     lea iy, iy + 3
     dec de
     ; Add renderWidth to xError
     add hl, bc
-    ; If no carry (xError did not wrap around from being negative to positive),
-    ; jump to the beginning of the loop
-    jr nc, move_row_buffer_loop
-check_x:
-    ; Push rowBuffer back onto the stack
-    push iy
+    ; If carry (xError wrapped around from being negative to positive), draw the next pixel
+    jr c, next_pixel
+    ; Otherwise, keep skipping pixels, as long as there are any left
+    ld a, d
+    or a, e
+    jr nz, skip_pixel
+    jr the_end
+next_pixel:
     ; Update xError
     ld (ix + xError), hl
     ; Check if x is 0
-    sbc hl, hl
-    adc hl, de
+    ld a, d
+    or a, e
     ; If it's not 0, jump to the beginning
     jr nz, fill_pixels
 the_end:
+    ; Save xError for the next run of pixels
+    ld iy, (ix + state)
+    ld (iy), hl
+return:
+    ; Return screenPointer
+    ld hl, (ix + screenPointer)
     ld sp, ix
     pop ix
     ret
 
-rowBuffer equ 6
-width equ 9
-renderWidth equ 12
-screenPointer equ 15
+pixels equ 6
+count equ 9
+width equ 12
+renderWidth equ 15
+screenPointer equ 18
+state equ 21
 xError equ -3
 varX equ -6
-varErr equ -9
 
-extern _rgb888to565
\ No newline at end of file
+extern _rgb888to565
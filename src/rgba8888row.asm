@@ -2,55 +2,74 @@ assume adl=1
 section .text
 public _displayRGBARow
 ; Arguments (C Convention):
-; uint8_t* rowBuffer
+; uint8_t* pixels
+; unsigned int count (must be less than 65536)
 ; unsigned int width
 ; unsigned int renderWidth
 ; uint16_t* screenPointer
+; RowState* state
+; Returns:
+; hl: screenPointer after the last pixel written
 _displayRGBARow:
     ; Local variables:
     ; int xError
     ; unsigned int x
-    ; ColorError err
+    ; uint8_t color[3]
+    ; uint8_t* pixel
     ; Init IX
     push ix
     ld ix, 0
     add ix, sp
 
     ; Make room on the stack for local variables
-    ld hl, -9
+    ld hl, -12
     add hl, sp
     ld sp, hl
 
-    ; Check that width > 0
-    ld hl, (ix + width)
-    ld bc, -1
-    adc hl, bc
+    ; Load xError from state
+    ld hl, (ix + state)
+    ld de, (hl)
+    ld (ix + xError), de
 
-    ; If width is 0, return
-    jp z, the_end
+    ; Push &state->err to the stack for rgb888to565
+    inc hl
+    inc hl
+    inc hl
+    push hl
 
-    ; Init local variables
-    inc bc
-    ld (ix + xError), bc
-    ld (ix + varErr), bc
+    ; Check that count > 0
+    ld de, (ix + count)
+    sbc hl, hl
+    adc hl, de
+
+    ; If count is 0, return
+    jp z, return
+
+    ; Init the registers
+    ld iy, (ix + pixels)
+    ld hl, (ix + xError)
+    ld bc, (ix + renderWidth)
 
-    ; Push &err to the stack for rgb888to565
-    pea ix + varErr
-    ; Push rowBuffer to the stack
-    ld de, (ix + rowBuffer)
-    push de
+    ; If the first pixel doesn't get drawn (the last run of pixels ended partway through skipping), go straight to skipping
+    bit 7, (ix + xError + 2)
+    jr nz, skip_pixel
 
 fill_pixels:
-    ; Write varX back to local variables
-    ld (ix + varX), hl
+    ; Write x back to local variables
+    ld (ix + varX), de
+    ; Save pixels to local variables
+    ld (ix + varPixel), iy
     ; Set the alpha values for each pixel
+    ; The pixels are still sitting in the input buffer, so the result goes into color rather than back over the pixel
     ; Register allocation
     ; A: alpha
     ; HL: pixel / ((pixel*alpha)/255)
     ; BC: 255
-    ; IY: rowBuffer
-    ; Put rowBuffer into IY
-    ld iy, (ix - 15)
+    ; IY: pixels
+
+    ; Copy the pixel into color
+    ld hl, (iy)
+    ld (ix + varColor), hl
 
     ; Load the alpha value into A
     ld a, (iy + 3)
@@ -65,30 +84,30 @@ fill_pixels:
 
     ; Set the pixel to 0
     ld bc, 0
-    ld (iy), bc
+    ld (ix + varColor), bc
     jr alpha_cont
 
 alpha_not_zero:
     ; Set each pixel value to ((pixel*alpha)/255)
     ld bc, 255
     ld h, a
-    ld l, (iy)
+    ld l, (ix + varColor)
     mlt hl
     call __sdivu
-    ld (iy), l
+    ld (ix + varColor), l
 
     ld h, a
-    ld l, (iy + 1)
+    ld l, (ix + varColor + 1)
     mlt hl
     call __sdivu
-    ld (iy + 1), l
+    ld (ix + varColor + 1), l
 
     ld h, a
-    ld l, (iy + 2)
+    ld l, (ix + varColor + 2)
     mlt hl
     call __sdivu
-    ld (iy + 2), l
-    
+    ld (ix + varColor + 2), l
+
 alpha_cont:
     ; Register allocation
     ; HL: xError
@@ -96,7 +115,9 @@ alpha_cont:
     ; BC: width
     ; IY: screenPointer
     ; Get the pixel value
+    pea ix + varColor
     call _rgb888to565
+    pop de
     ; Init the registers
     ex de, hl
     ld hl, (ix + xError)
@@ -115,50 +136,59 @@ fill_pixel_loop:
     ; If no carry (xError did not wrap around from being positive to negative),
     ; jump to the beginning of the loop
     jr nc, fill_pixel_loop
-move_row_buffer:
     ; Update screenPointer
     ld (ix + screenPointer), iy
     ; Register allocation
     ; HL: xError
     ; DE: x
     ; BC: renderWidth
-    ; IY: rowBuffer
+    ; IY: pixels
     ; Init the registers
     ld de, (ix + varX)
     ld bc, (ix + renderWidth)
-    pop iy
-move_row_buffer_loop:
-    ; While xError < 0, update x, rowBuffer and xError
+    ld iy, (ix + varPixel)
+skip_pixel:
+    ; While xError < 0, update x, pixels and xError
     lea iy, iy + 4
     dec de
     ; Add renderWidth to xError
     add hl, bc
-    ; If no carry (xError did not wrap around from being negative to positive),
-    ; jump to the beginning of the loop
-    jr nc, move_row_buffer_loop
-check_x:
-    ; Push rowBuffer back onto the stack
-    push iy
-    ; Update x and xError
-    ld (ix + varX), de
+    ; If carry (xError wrapped around from being negative to positive), draw the next pixel
+    jr c, next_pixel
+    ; Otherwise, keep skipping pixels, as long as there are any left
+    ld a, d
+    or a, e
+    jr nz, skip_pixel
+    jr the_end
+next_pixel:
+    ; Update xError
     ld (ix + xError), hl
     ; Check if x is 0
-    sbc hl, hl
-    adc hl, de
+    ld a, d
+    or a, e
     ; If it's not 0, jump to the beginning
-    jr nz, fill_pixels
+    jp nz, fill_pixels
 the_end:
+    ; Save xError for the next run of pixels
+    ld iy, (ix + state)
+    ld (iy), hl
+return:
+    ; Return screenPointer
+    ld hl, (ix + screenPointer)
     ld sp, ix
     pop ix
     ret
 
-rowBuffer equ 6
-width equ 9
-renderWidth equ 12
-screenPointer equ 15
+pixels equ 6
+count equ 9
+width equ 12
+renderWidth equ 15
+screenPointer equ 18
+state equ 21
 xError equ -3
 varX equ -6
-varErr equ -9
+varColor equ -9
+varPixel equ -12
 
 extern _rgb888to565
-extern __sdivu
\ No newline at end of file
+extern __sdivu
@@ -0,0 +1,167 @@
+#include <cstring>
+#include <cstdint>
+#include "screen.hpp"
+#include "common.h"
+
+// Blacks out the parts of the screen around an image, without touching the area the image is about to be drawn over.
+// imageTopLeft points to the top left corner of the image in vram.
+void clearBorders(uint16_t* imageTopLeft, unsigned int renderWidth, unsigned int renderHeight) {
+    uint16_t* imageEnd = imageTopLeft + (renderHeight*320);
+    // Everything above the image (finishing with the left strip of the first row)
+    memset(vram, 0, (imageTopLeft - vram)*sizeof(uint16_t));
+    // The strips to the left and right of each row (joined together, since the right strip of one row runs into the left strip of the next)
+    if (renderWidth < 320) {
+        for (uint16_t* rowPointer = imageTopLeft + renderWidth; rowPointer + (320 - renderWidth) < imageEnd; rowPointer += 320) {
+            memset(rowPointer, 0, (320 - renderWidth)*sizeof(uint16_t));
+        }
+    }
+    // Everything below the image (starting with the right strip of the last row)
+    memset(imageEnd - (320 - renderWidth), 0, ((vram + (320*240)) - (imageEnd - (320 - renderWidth)))*sizeof(uint16_t));
+}
+
+// Values for the BPP field of the LCD control register
+enum lcdModes {
+    lcd8bpp = 0x6,
+    lcd1555 = 0x8,
+    lcd565 = 0xC
+};
+
+// The half of vram that's on screen while the LCD is in 8bpp mode (nullptr while it's in 16bpp mode)
+static uint8_t* shownPage = nullptr;
+// The palette for the 8bpp frame that's being drawn, as 1-5-5-5 colors ready to go into the LCD's palette RAM.
+// It only gets loaded once the frame is shown, so the frame that's on screen keeps its colors until then.
+static uint16_t framePalette[256];
+
+bool drawOffScreen = false;
+uint8_t* preparedPage = nullptr;
+bool drawInterrupted = false;
+
+// Switches the LCD to another color mode, without touching any of the other settings in the LCD control register
+static void setLCDMode(uint8_t mode) {
+    *(reinterpret_cast<uint8_t*>(0xE30018)) = (*(reinterpret_cast<uint8_t*>(0xE30018)) & 0xF1) | mode;
+}
+
+// Points the LCD at a different frame in vram
+static void setLCDBase(void* base) {
+    *(reinterpret_cast<void**>(0xE30010)) = base;
+}
+
+// Puts the LCD in 16bpp mode (BGR 565, or BGR 1555 if bgr1555 is set), showing the start of vram
+void use16bppMode(bool bgr1555) {
+    setLCDMode(bgr1555 ? lcd1555 : lcd565);
+    setLCDBase(vram);
+    shownPage = nullptr;
+}
+
+// Picks the half of vram to draw the next 8bpp frame into, and fills it with background.
+// If an 8bpp frame is already on screen, it's the other half, so the frame on screen isn't touched.
+// Otherwise the screen is blanked (in 8bpp mode) and the second half is used.
+uint8_t* start8bppFrame(uint8_t background) {
+    uint8_t* page;
+    if (shownPage) {
+        page = (shownPage == vramPage1) ? vramPage2 : vramPage1;
+    } else {
+        memset(vramPage1, 0, 320*240);
+        *(reinterpret_cast<uint16_t*>(0xE30200)) = 0;
+        setLCDBase(vramPage1);
+        setLCDMode(lcd8bpp);
+        shownPage = vramPage1;
+        page = vramPage2;
+    }
+    memset(page, background, 320*240);
+    return page;
+}
+
+// Sets the palette of the 8bpp frame being drawn from a 5-6-5 palette (like the ones from generatePalette).
+// The palette RAM holds 1-5-5-5 colors, so the lowest bit of green gets dropped.
+// Entries past the end of the palette are set to black.
+void setFramePalette(uint16_t* palette, unsigned int colors) {
+    for (unsigned int i = 0; i < 256; i++) {
+        framePalette[i] = (i < colors) ? ((palette[i] >> 1) & 0x7FE0) | (palette[i] & 0x1F) : 0;
+    }
+}
+
+// Sets the palette of the 8bpp frame being drawn to a black to white ramp, so that 8 bit gray values can be written straight to it
+void setFrameGrayRamp() {
+    for (unsigned int i = 0; i < 256; i++) {
+        uint16_t level = i >> 3;
+        framePalette[i] = (level << 10) | (level << 5) | level;
+    }
+}
+
+// Whether the LCD is showing an 8bpp frame (so the next one can be drawn off screen)
+bool showing8bppFrame() {
+    return shownPage != nullptr;
+}
+
+// Puts a finished 8bpp frame on screen, along with its palette
+void show8bppFrame(uint8_t* page) {
+    memcpy(reinterpret_cast<uint16_t*>(0xE30200), framePalette, sizeof(framePalette));
+    setLCDBase(page);
+    shownPage = page;
+}
+
+// Either shows a finished 8bpp frame, or (if drawOffScreen is set) leaves it in preparedPage to be shown later
+void finish8bppFrame(uint8_t* page) {
+    if (drawOffScreen) {
+        preparedPage = page;
+    } else {
+        show8bppFrame(page);
+    }
+}
+
+// What sort of frame is on screen
+uint8_t shownFrameFormat() {
+    if (shownPage) {
+        return frame8bpp;
+    }
+    return ((*(reinterpret_cast<uint8_t*>(0xE30018)) & 0x0E) == lcd1555) ? frame1555 : frame565;
+}
+
+// The pixels of the frame that's on screen
+uint8_t* shownFramePixels() {
+    return shownPage ? shownPage : reinterpret_cast<uint8_t*>(vram);
+}
+
+// Gets the palette of the 8bpp frame that's on screen as 5-6-5 colors (ready to go back into setFramePalette)
+void getShownPalette(uint16_t* palette) {
+    uint16_t* lcdPalette = reinterpret_cast<uint16_t*>(0xE30200);
+    for (unsigned int i = 0; i < 256; i++) {
+        palette[i] = ((lcdPalette[i] & 0x7FE0) << 1) | (lcdPalette[i] & 0x1F);
+    }
+}
+
+// Shrinks whatever is on screen down to a width x height 5-6-5 image, averaging each block of pixels.
+// width and height must divide 320 and 240.
+void captureScreen(uint16_t* out, unsigned int width, unsigned int height) {
+    unsigned int blockWidth = 320/width;
+    unsigned int blockHeight = 240/height;
+    unsigned int blockSize = blockWidth*blockHeight;
+    uint16_t* lcdPalette = reinterpret_cast<uint16_t*>(0xE30200);
+    bool bgr1555 = shownFrameFormat() == frame1555;
+    for (unsigned int y = 0; y < height; y++) {
+        for (unsigned int x = 0; x < width; x++) {
+            unsigned int sums[3] = {0, 0, 0};
+            for (unsigned int row = 0; row < blockHeight; row++) {
+                unsigned int offset = (((y*blockHeight) + row)*320) + (x*blockWidth);
+                for (unsigned int column = 0; column < blockWidth; column++) {
+                    uint16_t color;
+                    if (shownPage) {
+                        // 8bpp pixels are indices into the palette RAM, which holds 1-5-5-5 colors
+                        color = lcdPalette[shownPage[offset + column]];
+                        color = ((color & 0x7FE0) << 1) | (color & 0x1F);
+                    } else if (bgr1555) {
+                        color = vram[offset + column];
+                        color = ((color & 0x7FE0) << 1) | (color & 0x1F);
+                    } else {
+                        color = vram[offset + column];
+                    }
+                    sums[0] += color >> 11;
+                    sums[1] += (color >> 5) & 0x3F;
+                    sums[2] += color & 0x1F;
+                }
+            }
+            *out++ = ((sums[0]/blockSize) << 11) | ((sums[1]/blockSize) << 5) | (sums[2]/blockSize);
+        }
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+
+// In 8bpp mode a frame only takes up half of vram, so one half can be drawn to while the other is on screen
+#define vramPage1 (reinterpret_cast<uint8_t*>(0xD40000))
+#define vramPage2 (reinterpret_cast<uint8_t*>(0xD40000) + (320*240))
+
+// Set by the slideshow while the current image is still on screen.
+// Images that can be drawn in 8bpp mode get drawn into the half of vram that isn't on screen, and left in preparedPage
+// for show8bppFrame; anything else doesn't get drawn at all (preparedPage is left as nullptr).
+extern bool drawOffScreen;
+extern uint8_t* preparedPage;
+// Set when a key press stops an image from being drawn before it's finished.
+// The decoder has used the key up by then, so this is the only way anyone else gets to find out about it.
+extern bool drawInterrupted;
+
+void clearBorders(uint16_t* imageTopLeft, unsigned int renderWidth, unsigned int renderHeight);
+
+void use16bppMode(bool bgr1555);
+uint8_t* start8bppFrame(uint8_t background);
+void setFramePalette(uint16_t* palette, unsigned int colors);
+void setFrameGrayRamp();
+bool showing8bppFrame();
+void show8bppFrame(uint8_t* page);
+void finish8bppFrame(uint8_t* page);
+// The different kinds of frame that can be on screen
+enum frameFormats {
+    frame565 = 0,
+    frame1555,
+    frame8bpp
+};
+
+uint8_t shownFrameFormat();
+uint8_t* shownFramePixels();
+void getShownPalette(uint16_t* palette);
+void captureScreen(uint16_t* out, unsigned int width, unsigned int height);
@@ -0,0 +1,176 @@
+#include <cstring>
+#include <cstdint>
+#include <graphx.h>
+#include "thumbnail.hpp"
+#include "screen.hpp"
+#include "cache.hpp"
+#include "usb.h"
+
+// Thumbnails are drawn with a 6x6x6 color cube, which sits in the unused part of the graphx palette
+#define cubeStart 32
+// How many thumbnails are kept in memory, so that moving the selection around doesn't read them from the drive again.
+// One more than the number of rows the file browser shows.
+#define thumbnailSlots 6
+
+// A thumbnail file. It gets written in whole blocks, so it's padded out to the next one.
+union thumbnailFile {
+    struct {
+        char magic[4];
+        cacheKey key;
+        uint16_t pixels[thumbnailWidth*thumbnailHeight];
+    } contents;
+    uint8_t blocks[4*FAT_BLOCK_SIZE];
+};
+static_assert(sizeof(thumbnailFile) == 4*FAT_BLOCK_SIZE, "Thumbnail files must fit in 4 blocks");
+
+struct thumbnailSlot {
+    char name[13];
+    // Whether the image has a thumbnail (if not, sprite is left alone)
+    bool found;
+    // For picking the slot that was used the longest time ago
+    unsigned int lastUsed;
+    uint8_t sprite[2 + (thumbnailWidth*thumbnailHeight)];
+};
+
+static thumbnailSlot slots[thumbnailSlots];
+static unsigned int slotClock = 0;
+// The directory the slots hold thumbnails for
+static uint32_t slotsPathHash = 0;
+
+// The image the next captureThumbnail call is for
+static bool wanted = false;
+static bool captured = false;
+static char wantedPath[256];
+static char wantedName[13];
+static uint16_t capturedPixels[thumbnailWidth*thumbnailHeight];
+
+// Maps 5-6-5 pixels to the nearest colors in the cube, and puts them in a sprite
+static void pixelsToSprite(uint8_t* sprite, const uint16_t* pixels) {
+    sprite[0] = thumbnailWidth;
+    sprite[1] = thumbnailHeight;
+    for (unsigned int i = 0; i < thumbnailWidth*thumbnailHeight; i++) {
+        unsigned int red = ((pixels[i] >> 11)*5 + 15)/31;
+        unsigned int green = (((pixels[i] >> 5) & 0x3F)*5 + 31)/63;
+        unsigned int blue = ((pixels[i] & 0x1F)*5 + 15)/31;
+        sprite[i + 2] = cubeStart + (red*36) + (green*6) + blue;
+    }
+}
+
+// Picks the slot to load a thumbnail into, forgetting whatever was in there before
+static thumbnailSlot* freeSlot(const char* name) {
+    thumbnailSlot* oldest = &slots[0];
+    for (unsigned int i = 1; i < thumbnailSlots; i++) {
+        if (slots[i].lastUsed < oldest->lastUsed) {
+            oldest = &slots[i];
+        }
+    }
+    strncpy(oldest->name, name, 12);
+    oldest->name[12] = 0;
+    oldest->found = false;
+    oldest->lastUsed = ++slotClock;
+    return oldest;
+}
+
+void setThumbnailPalette() {
+    for (unsigned int red = 0; red < 6; red++) {
+        for (unsigned int green = 0; green < 6; green++) {
+            for (unsigned int blue = 0; blue < 6; blue++) {
+                gfx_palette[cubeStart + (red*36) + (green*6) + blue] = (((red*31 + 2)/5) << 10) | (((green*31 + 2)/5) << 5) | ((blue*31 + 2)/5);
+            }
+        }
+    }
+}
+
+gfx_sprite_t* findThumbnail(const char* path, const char* name) {
+    uint32_t pathHash = hashPath(path);
+    if (pathHash != slotsPathHash) {
+        // Moved to a different directory, so none of the slots are any use
+        memset(slots, 0, sizeof(slots));
+        slotsPathHash = pathHash;
+    }
+    for (unsigned int i = 0; i < thumbnailSlots; i++) {
+        if (slots[i].lastUsed && strcmp(slots[i].name, name) == 0) {
+            slots[i].lastUsed = ++slotClock;
+            return slots[i].found ? reinterpret_cast<gfx_sprite_t*>(slots[i].sprite) : nullptr;
+        }
+    }
+    thumbnailSlot* slot = freeSlot(name);
+    cacheKey key;
+    char fileName[13];
+    if (!makeCacheKey(&key, path, name, false)) {
+        return nullptr;
+    }
+    cacheFileName(fileName, &key, "THM");
+    fat_file_t* file = openFile(cacheDir, fileName, false);
+    if (!file) {
+        return nullptr;
+    }
+    thumbnailFile* thumbnail = new thumbnailFile;
+    if (!thumbnail) {
+        // No memory to read it into, so carry on as if there wasn't one
+        closeFile(file);
+        return nullptr;
+    }
+    if (readFile(file, 4, thumbnail) &&
+        memcmp(thumbnail->contents.magic, "TH84", 4) == 0 &&
+        memcmp(&thumbnail->contents.key, &key, sizeof(cacheKey)) == 0) {
+        pixelsToSprite(slot->sprite, thumbnail->contents.pixels);
+        slot->found = true;
+    }
+    delete thumbnail;
+    closeFile(file);
+    return slot->found ? reinterpret_cast<gfx_sprite_t*>(slot->sprite) : nullptr;
+}
+
+void startThumbnail(const char* path, const char* name) {
+    captured = false;
+    wanted = !findThumbnail(path, name);
+    strncpy(wantedPath, path, 255);
+    wantedPath[255] = 0;
+    strncpy(wantedName, name, 12);
+    wantedName[12] = 0;
+}
+
+void captureThumbnail() {
+    if (wanted) {
+        captureScreen(capturedPixels, thumbnailWidth, thumbnailHeight);
+        captured = true;
+    }
+}
+
+void finishThumbnail() {
+    bool save = captured;
+    wanted = false;
+    captured = false;
+    if (!save) {
+        return;
+    }
+    thumbnailFile* thumbnail = new thumbnailFile;
+    char fileName[13];
+    if (!thumbnail) {
+        return;
+    }
+    memset(thumbnail, 0, sizeof(thumbnailFile));
+    memcpy(thumbnail->contents.magic, "TH84", 4);
+    memcpy(thumbnail->contents.pixels, capturedPixels, sizeof(capturedPixels));
+    if (makeCacheKey(&thumbnail->contents.key, wantedPath, wantedName, false)) {
+        cacheFileName(fileName, &thumbnail->contents.key, "THM");
+        fat_file_t* file = createCacheFile(fileName);
+        if (writeFile(file, sizeof(thumbnailFile), thumbnail)) {
+            // Show it in the file browser straight away
+            thumbnailSlot* slot = nullptr;
+            for (unsigned int i = 0; i < thumbnailSlots; i++) {
+                if (slots[i].lastUsed && strcmp(slots[i].name, wantedName) == 0) {
+                    slot = &slots[i];
+                }
+            }
+            if (!slot) {
+                slot = freeSlot(wantedName);
+            }
+            pixelsToSprite(slot->sprite, capturedPixels);
+            slot->found = true;
+        }
+        closeFile(file);
+    }
+    delete thumbnail;
+}
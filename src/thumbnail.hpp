@@ -0,0 +1,17 @@
+#pragma once
+#include <graphx.h>
+
+// Thumbnails are shrunk down from the screen, so they keep its 4:3 shape
+#define thumbnailWidth 32
+#define thumbnailHeight 24
+
+// Puts the colors thumbnails are drawn with into the graphx palette
+void setThumbnailPalette();
+// Gets the thumbnail for an image, ready to be drawn with graphx, or nullptr if it hasn't been cached yet
+gfx_sprite_t* findThumbnail(const char* path, const char* name);
+// Call before an image is displayed. If the image doesn't have a thumbnail yet, the next captureThumbnail call takes one.
+void startThumbnail(const char* path, const char* name);
+// Call while the image is on screen
+void captureThumbnail();
+// Call once the image has been closed, to save the thumbnail (if one was taken) to the cache
+void finishThumbnail();
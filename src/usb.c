@@ -19,6 +19,44 @@ static msd_partition_t partitions[MAX_PARTITIONS];
 static global_t global;
 static char name[16];
 static char path[256];
+// Open files come out of here rather than the heap, so opening image after image can't break the heap up
+static fat_file_t filePool[MAX_OPEN_FILES];
+static bool fileInUse[MAX_OPEN_FILES];
+
+// Background reads.
+// fat_ReadFile hands each run of blocks it needs to readBlocks. If they're going into the buffer readFileAsync was called with,
+// they get started with msd_ReadAsync and left to finish on their own, so the next chunk of a file can come in over USB
+// while the current one is being decoded. Everything else (like the FAT itself) gets read straight away.
+static msd_transfer_t transfers[MAX_ASYNC_TRANSFERS];
+static bool transferBusy[MAX_ASYNC_TRANSFERS];
+static uint8_t* asyncStart = NULL;
+static uint8_t* asyncEnd = NULL;
+static uint8_t pendingReads = 0;
+static bool asyncFailed = false;
+
+// Where everything is on the FAT32 volume, so files' cluster chains can be followed without going through fatdrvce
+static struct {
+    uint32_t fatStart;
+    uint32_t dataStart;
+    uint8_t clusterBlocks;
+    bool valid;
+} volume;
+
+// Extent maps.
+// fat_ReadFile follows the cluster chain every time it's called, and splits reads up at every cluster.
+// Instead, the chain gets followed once when a file's opened, and each run of clusters that are next to each other on the drive
+// is kept as one extent, so reads can go straight to the drive with one msd_Read per run.
+// Files that are in too many pieces (or are being written) just go through fatdrvce.
+typedef struct {
+    uint32_t lba;
+    uint32_t blocks;
+} fileExtent;
+static fileExtent extents[MAX_OPEN_FILES][MAX_FILE_EXTENTS];
+// How many extents each open file has (0 if it doesn't have a map)
+static uint8_t extentCount[MAX_OPEN_FILES];
+// Where mapped files are up to, in blocks (fatdrvce's own position isn't kept up to date)
+static uint32_t filePosition[MAX_OPEN_FILES];
+static uint8_t fatSector[FAT_BLOCK_SIZE];
 
 void stringToUpper(char* buffer, size_t bufferLength, const char* str) {
     size_t i = 0;
@@ -53,6 +91,153 @@ usb_error_t handleUsbEvent(usb_event_t event, void *event_data, usb_callback_dat
     return USB_SUCCESS;
 }
 
+static void asyncReadDone(msd_error_t error, msd_transfer_t* transfer) {
+    if (error != MSD_SUCCESS) {
+        asyncFailed = true;
+    }
+    transferBusy[transfer - transfers] = false;
+    pendingReads--;
+}
+
+static uint24_t readBlocks(msd_t* msd, uint32_t lba, uint24_t count, void* buffer) {
+    if ((uint8_t*)buffer >= asyncStart && (uint8_t*)buffer < asyncEnd) {
+        for (uint8_t i = 0; i < MAX_ASYNC_TRANSFERS; i++) {
+            if (!transferBusy[i]) {
+                msd_transfer_t* transfer = &transfers[i];
+                transfer->msd = msd;
+                transfer->lba = lba;
+                transfer->buffer = buffer;
+                transfer->count = count;
+                transfer->callback = asyncReadDone;
+                transfer->userptr = NULL;
+                // Counted before it's started, in case it finishes straight away
+                transferBusy[i] = true;
+                pendingReads++;
+                if (msd_ReadAsync(transfer) == MSD_SUCCESS) {
+                    return count;
+                }
+                transferBusy[i] = false;
+                pendingReads--;
+                break;
+            }
+        }
+    }
+    return msd_Read(msd, lba, count, buffer);
+}
+
+// Waits for any background reads to finish, without touching asyncFailed so whoever started them still finds out if they didn't work
+static void drainReads(void) {
+    while (pendingReads) {
+        if (usb_WaitForEvents() != USB_SUCCESS) {
+            // The drive's gone, so the reads are never going to finish
+            asyncFailed = true;
+            break;
+        }
+    }
+}
+
+// Reads the boot sector of the partition fatdrvce opened, to find the FAT and the first cluster
+static void readVolume(uint32_t firstBlock) {
+    volume.valid = false;
+    if (msd_Read(&global.msd, firstBlock, 1, fatSector) != 1) {
+        return;
+    }
+    uint16_t bytesPerBlock = fatSector[11] | (fatSector[12] << 8);
+    uint16_t reservedBlocks = fatSector[14] | (fatSector[15] << 8);
+    uint32_t fatBlocks = fatSector[36] | ((uint32_t)fatSector[37] << 8) | ((uint32_t)fatSector[38] << 16) | ((uint32_t)fatSector[39] << 24);
+    volume.clusterBlocks = fatSector[13];
+    if (bytesPerBlock != FAT_BLOCK_SIZE || !volume.clusterBlocks || !fatBlocks) {
+        return;
+    }
+    volume.fatStart = firstBlock + reservedBlocks;
+    volume.dataStart = volume.fatStart + fatSector[16]*fatBlocks;
+    volume.valid = true;
+}
+
+// Follows a file's cluster chain and fills in its extents.
+// Leaves the file without a map if the chain looks wrong or the file's in too many pieces.
+static void mapFile(fat_file_t* file) {
+    unsigned int index = file - filePool;
+    uint16_t* entryPointer = *((uint16_t**)(&file->priv[40]));
+    uint32_t cluster = ((uint32_t)entryPointer[10] << 16) | entryPointer[13];
+    uint32_t blocksLeft = (fat_GetFileSize(file) + FAT_BLOCK_SIZE - 1)/FAT_BLOCK_SIZE;
+    uint32_t loadedSector = 0;
+    uint8_t count = 0;
+    extentCount[index] = 0;
+    filePosition[index] = 0;
+    if (!volume.valid) {
+        return;
+    }
+    while (blocksLeft) {
+        uint32_t lba;
+        uint32_t blocks = volume.clusterBlocks;
+        if (cluster < 2 || cluster >= 0x0FFFFFF7) {
+            return;
+        }
+        if (blocks > blocksLeft) {
+            blocks = blocksLeft;
+        }
+        lba = volume.dataStart + (cluster - 2)*volume.clusterBlocks;
+        if (count && extents[index][count - 1].lba + extents[index][count - 1].blocks == lba) {
+            extents[index][count - 1].blocks += blocks;
+        } else {
+            if (count == MAX_FILE_EXTENTS) {
+                return;
+            }
+            extents[index][count].lba = lba;
+            extents[index][count].blocks = blocks;
+            count++;
+        }
+        blocksLeft -= blocks;
+        if (blocksLeft) {
+            // Each block of the FAT holds 128 entries
+            uint32_t sector = volume.fatStart + cluster/128;
+            if (sector != loadedSector) {
+                if (msd_Read(&global.msd, sector, 1, fatSector) != 1) {
+                    return;
+                }
+                loadedSector = sector;
+            }
+            cluster = ((uint32_t*)fatSector)[cluster % 128] & 0x0FFFFFFF;
+        }
+    }
+    extentCount[index] = count;
+}
+
+// Goes back to reading (and writing) a file through fatdrvce, putting its position back where the map had it
+static void unmapFile(fat_file_t* file) {
+    unsigned int index = file - filePool;
+    if (extentCount[index]) {
+        extentCount[index] = 0;
+        fat_SetFileBlockOffset(file, filePosition[index]);
+    }
+}
+
+// Reads blocks from a mapped file, one run at a time
+static bool readMappedFile(fat_file_t* file, size_t blocks, uint8_t* buffer) {
+    unsigned int index = file - filePool;
+    uint32_t position = filePosition[index];
+    uint32_t extentStart = 0;
+    for (uint8_t i = 0; i < extentCount[index] && blocks; i++) {
+        fileExtent* extent = &extents[index][i];
+        if (position < extentStart + extent->blocks) {
+            uint32_t run = extentStart + extent->blocks - position;
+            if (run > blocks) {
+                run = blocks;
+            }
+            if (readBlocks(&global.msd, extent->lba + (position - extentStart), run, buffer) != run) {
+                return false;
+            }
+            position += run;
+            buffer += run*FAT_BLOCK_SIZE;
+            blocks -= run;
+        }
+        extentStart += extent->blocks;
+    }
+    filePosition[index] = position;
+    return blocks == 0;
+}
+
 bool init_USB() {
     usb_error_t usberr;
     msd_info_t msdinfo;
@@ -79,8 +264,9 @@ bool init_USB() {
         goto cleanup;
     }
     for (uint8_t i = 0; i < num_partitions; i++) {
-        if (!fat_Open(&global.fat, (fat_read_callback_t) &msd_Read, (fat_write_callback_t) &msd_Write, &global.msd, partitions[i].first_lba)) {
+        if (!fat_Open(&global.fat, (fat_read_callback_t) &readBlocks, (fat_write_callback_t) &msd_Write, &global.msd, partitions[i].first_lba)) {
             global.fatInit = true;
+            readVolume(partitions[i].first_lba);
             return true;
         }
     }
@@ -89,40 +275,69 @@ bool init_USB() {
     return false;
 }
 
+// Where the file's up to, in blocks
+static uint32_t getFilePosition(fat_file_t* file) {
+    if (extentCount[file - filePool]) {
+        return filePosition[file - filePool];
+    }
+    return fat_GetFileBlockOffset(file);
+}
+
+static void freeFileHandle(fat_file_t* file) {
+    fileInUse[file - filePool] = false;
+}
+
 fat_file_t* openFile(const char* sourcePath, const char* sourceName, bool create) {
-    fat_file_t* file = calloc(1, sizeof(fat_file_t));
+    fat_file_t* file = NULL;
+    for (unsigned int i = 0; i < MAX_OPEN_FILES; i++) {
+        if (!fileInUse[i]) {
+            fileInUse[i] = true;
+            file = &filePool[i];
+            memset(file, 0, sizeof(fat_file_t));
+            break;
+        }
+    }
+    if (file == NULL) {
+        return NULL;
+    }
     stringToUpper(name, 16, sourceName);
     if (sourcePath[0] == 0) {
         if (fat_OpenFile(&global.fat, name, 0, file) != FAT_SUCCESS) {
             /*printStringAndMoveDownCentered("Failed to open file");
             printStringAndMoveDownCentered(str);*/
-            free(file);
+            freeFileHandle(file);
             return NULL;
         }
     } else {
         stringToUpper(path, 256, sourcePath);
+        // fat_Create takes the directory the file goes in, so it has to be called before the name is added to the path
+        if (create) {
+            fat_Create(&global.fat, path, name, 0);
+        }
         if (path[strlen(path) - 1] != '/') {
             strncat(path, "/", 255-strlen(path));
         }
         strncat(path, name, 255-strlen(path));
-        if (create) {
-            fat_Create(&global.fat, path, name, 0);
-        }
         if (fat_OpenFile(&global.fat, path, 0, file) != FAT_SUCCESS) {
-            free(file);
+            freeFileHandle(file);
             return NULL;
         }
     }
-    // cursed hack to add support for created/modified dates
-    time_t currentTime;
-    time(&currentTime);
-    struct tm* currentLocalTime = localtime(&currentTime);
-    uint16_t* entryPointer = *((uint16_t**)(&file->priv[40]));
-    ((uint8_t*)entryPointer)[11] = FAT_ARCHIVE;
-    ((uint8_t*)entryPointer)[13] = 0;
-    entryPointer[11] = ((currentLocalTime->tm_sec)>>1) + (currentLocalTime->tm_min<<5) + (currentLocalTime->tm_hour<<11);
-    entryPointer[9] = entryPointer[12] = (currentLocalTime->tm_mday) + ((currentLocalTime->tm_mon + 1) << 5) + ((currentLocalTime->tm_year - 80)<<9);
-    if (create) {
+    // cursed hack to add support for created/modified dates.
+    // Only new files get stamped, so opening an image to look at it doesn't change when it was last modified
+    // (the caches key their entries on it).
+    if (!create) {
+        mapFile(file);
+    } else {
+        extentCount[file - filePool] = 0;
+        time_t currentTime;
+        time(&currentTime);
+        struct tm* currentLocalTime = localtime(&currentTime);
+        uint16_t* entryPointer = *((uint16_t**)(&file->priv[40]));
+        ((uint8_t*)entryPointer)[11] = FAT_ARCHIVE;
+        ((uint8_t*)entryPointer)[13] = 0;
+        entryPointer[11] = ((currentLocalTime->tm_sec)>>1) + (currentLocalTime->tm_min<<5) + (currentLocalTime->tm_hour<<11);
+        entryPointer[9] = entryPointer[12] = (currentLocalTime->tm_mday) + ((currentLocalTime->tm_mon + 1) << 5) + ((currentLocalTime->tm_year - 80)<<9);
         entryPointer[7] = entryPointer[11];
         entryPointer[8] = entryPointer[12];
     }
@@ -131,45 +346,75 @@ fat_file_t* openFile(const char* sourcePath, const char* sourceName, bool create
 
 void closeFile(fat_file_t* file) {
     if (file != NULL) {
+        drainReads();
         fat_CloseFile(file);
-        free(file);
+        freeFileHandle(file);
     }
 }
 
-fat_dir_t* openDir(const char* sourcePath) {
-    fat_dir_t* folder = calloc(1, sizeof(fat_dir_t));
+bool openDir(fat_dir_t* folder, const char* sourcePath) {
     stringToUpper(path, 256, sourcePath);
-    if (fat_OpenDir(&global.fat, path, folder) != FAT_SUCCESS) {
-        free(folder);
-        return NULL;
-    }
-    return folder;
+    return fat_OpenDir(&global.fat, path, folder) == FAT_SUCCESS;
 }
 
 void closeDir(fat_dir_t* folder) {
-    if (folder) {
-        fat_CloseDir(folder);
-        free(folder);
-    }
+    fat_CloseDir(folder);
 }
 
-bool readFile(fat_file_t* file, size_t bufferSize, void* buffer) {
+static bool readFileBlocks(fat_file_t* file, size_t bufferSize, void* buffer) {
     if (file == NULL) {
         return false;
     }
-    size_t readSize = ((fat_GetFileSize(file) + 511)/FAT_BLOCK_SIZE) - fat_GetFileBlockOffset(file);
+    size_t readSize = ((fat_GetFileSize(file) + 511)/FAT_BLOCK_SIZE) - getFilePosition(file);
     if (readSize > bufferSize) {
         readSize = bufferSize;
     }
+    if (extentCount[file - filePool]) {
+        return readMappedFile(file, readSize, buffer);
+    }
     bool good = fat_ReadFile(file, readSize, buffer) == readSize;
     return good;
 }
 
+bool readFile(fat_file_t* file, size_t bufferSize, void* buffer) {
+    // Anything still coming in might be going into the same buffer
+    drainReads();
+    return readFileBlocks(file, bufferSize, buffer);
+}
+
+bool readFileAsync(fat_file_t* file, size_t bufferSize, void* buffer) {
+    bool good;
+    // Only one background read at a time
+    drainReads();
+    asyncFailed = false;
+    asyncStart = buffer;
+    asyncEnd = (uint8_t*)buffer + bufferSize*FAT_BLOCK_SIZE;
+    good = readFileBlocks(file, bufferSize, buffer);
+    asyncStart = NULL;
+    asyncEnd = NULL;
+    return good;
+}
+
+bool waitForReads(void) {
+    bool good;
+    drainReads();
+    good = !asyncFailed;
+    asyncFailed = false;
+    return good;
+}
+
+void pumpReads(void) {
+    if (pendingReads) {
+        usb_HandleEvents();
+    }
+}
+
 bool writeFile(fat_file_t* file, size_t size, void* buffer) {
     if (file == NULL) {
         return false;
     }
     size_t writeBlocks = (size + FAT_BLOCK_SIZE - 1)/FAT_BLOCK_SIZE;
+    unmapFile(file);
     if (fat_SetFileSize(file, size)) {
         // printStringAndMoveDownCentered("Failed to set size");
         return false;
@@ -186,6 +431,22 @@ bool writeFile(fat_file_t* file, size_t size, void* buffer) {
     return good;
 }
 
+bool setFileSize(fat_file_t* file, uint32_t size) {
+    if (file == NULL) {
+        return false;
+    }
+    unmapFile(file);
+    return fat_SetFileSize(file, size) == FAT_SUCCESS;
+}
+
+bool writeFileBlocks(fat_file_t* file, size_t blocks, void* buffer) {
+    if (file == NULL) {
+        return false;
+    }
+    unmapFile(file);
+    return fat_WriteFile(file, blocks, buffer) == blocks;
+}
+
 bool seekFile(fat_file_t* file, size_t blockOffset, seek_origin_t origin) {
     // All of these numbers are in blocks.
     size_t pos;
@@ -199,7 +460,7 @@ bool seekFile(fat_file_t* file, size_t blockOffset, seek_origin_t origin) {
             pos = blockOffset;
             break;
         case cur:
-            pos = fat_GetFileBlockOffset(file) + blockOffset;
+            pos = getFilePosition(file) + blockOffset;
             break;
         case end:
             pos = fileSize - blockOffset;
@@ -210,20 +471,46 @@ bool seekFile(fat_file_t* file, size_t blockOffset, seek_origin_t origin) {
     if (pos < 0 || pos > fileSize) {
         return false;
     }
+    if (extentCount[file - filePool]) {
+        // No need to follow the cluster chain, the map already knows where everything is
+        filePosition[file - filePool] = pos;
+        return true;
+    }
     return fat_SetFileBlockOffset(file, pos) == FAT_SUCCESS;
 }
 
-bool createDirectory(const char* sourcePath, const char* sourceName) {
+bool createDirectory(const char* sourcePath, const char* sourceName, bool hidden) {
     fat_error_t faterr;
     stringToUpper(name, 16, sourceName);
     stringToUpper(path, 256, sourcePath);
-    faterr = fat_Create(&global.fat, path, name, FAT_DIR);
+    faterr = fat_Create(&global.fat, path, name, hidden ? (FAT_DIR | FAT_HIDDEN) : FAT_DIR);
     if (faterr != FAT_SUCCESS && faterr != FAT_ERROR_EXISTS) {
         return false;
     }
     return true;
 } 
 
+// Gets the size of a file, and when it was last modified (the FAT date in the high 16 bits, and the FAT time in the low 16 bits).
+// Unlike openFile, this doesn't touch the file's dates.
+bool getFileStamp(const char* sourcePath, const char* sourceName, uint32_t* size, uint32_t* modified) {
+    fat_file_t file;
+    stringToUpper(name, 16, sourceName);
+    stringToUpper(path, 256, sourcePath);
+    if (path[strlen(path) - 1] != '/') {
+        strncat(path, "/", 255-strlen(path));
+    }
+    strncat(path, name, 255-strlen(path));
+    if (fat_OpenFile(&global.fat, path, 0, &file) != FAT_SUCCESS) {
+        return false;
+    }
+    // Same cursed hack openFile uses to get at the file's directory entry
+    uint16_t* entryPointer = *((uint16_t**)(&file.priv[40]));
+    *size = fat_GetFileSize(&file);
+    *modified = ((uint32_t)entryPointer[12] << 16) | entryPointer[11];
+    fat_CloseFile(&file);
+    return true;
+}
+
 uint32_t getSizeOf(fat_file_t* file) {
     if (file == NULL) {
         return 0;
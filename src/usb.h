@@ -8,6 +8,12 @@ typedef struct global global_t;
 #include <usbdrvce.h>
 
 #define MAX_PARTITIONS 32
+// The image, plus a cache file or two
+#define MAX_OPEN_FILES 4
+// How many runs of blocks a background read can be split into (one for each piece of the file that isn't next to the one before it)
+#define MAX_ASYNC_TRANSFERS 8
+// How many separate pieces a file can be in and still be read without going through fatdrvce
+#define MAX_FILE_EXTENTS 16
 
 struct global {
     usb_device_t usb;
@@ -27,15 +33,27 @@ typedef enum seek_origin {
 extern "C" {
 #endif
 
-fat_dir_t* openDir(const char* sourcePath);
+// The caller provides the memory for the directory (the file browser keeps it in the directory arena)
+bool openDir(fat_dir_t* folder, const char* sourcePath);
 void closeDir(fat_dir_t* folder);
 usb_error_t handleUsbEvent(usb_event_t event, void *event_data, usb_callback_data_t *global);
 
 // Takes size in blocks
 bool readFile(fat_file_t* file, size_t bufferSize, void* buffer);
+// Same as readFile, except the blocks get read in the background.
+// buffer can't be touched until waitForReads returns, and pumpReads needs to be called every so often in the meantime to keep them moving.
+bool readFileAsync(fat_file_t* file, size_t bufferSize, void* buffer);
+// Waits for any background reads to finish, and returns whether they all worked
+bool waitForReads(void);
+void pumpReads(void);
 
 bool writeFile(fat_file_t* file, size_t size, void* buffer);
-bool createDirectory(const char* path, const char* name);
+// Takes size in blocks. Writes at the current position without changing the size of the file,
+// so a file that's been sized with setFileSize can be written a piece at a time.
+bool writeFileBlocks(fat_file_t* file, size_t blocks, void* buffer);
+bool setFileSize(fat_file_t* file, uint32_t size);
+bool createDirectory(const char* path, const char* name, bool hidden);
+bool getFileStamp(const char* path, const char* name, uint32_t* size, uint32_t* modified);
 bool seekFile(fat_file_t* file, size_t blockOffset, seek_origin_t origin);
 fat_file_t* openFile(const char* path, const char* name, bool create);
 void closeFile(fat_file_t* file);